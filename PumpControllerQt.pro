@@ -11,28 +11,49 @@ CONFIG += c++17
 SOURCES += \
     comsdialog.cpp \
     condinterface.cpp \
+    condparser.cpp \
     condworker.cpp \
+    latencyhistogram.cpp \
+    lodseries.cpp \
     main.cpp \
+    phasecompiler.cpp \
     plotwidget.cpp \
     protocol.cpp \
+    protocolfile.cpp \
     pumpcommandworker.cpp \
     pumpcontroller.cpp \
+    pumpencoder.cpp \
     $$PWD/libs/qcustomplot/qcustomplot.cpp \
     pumpinterface.cpp \
+    pumpstatus.cpp \
+    ratestreamer.cpp \
+    runjournal.cpp \
+    serialframer.cpp \
     tablemodel.cpp \
     utils.cpp
 
 HEADERS += \
     comsdialog.h \
     condinterface.h \
+    condparser.h \
     condworker.h \
+    latencyhistogram.h \
+    lodseries.h \
+    phasecompiler.h \
     plotwidget.h \
     protocol.h \
+    protocolfile.h \
     pumpcommands.h \
     pumpcommandworker.h \
     pumpcontroller.h \
+    pumpencoder.h \
     $$PWD/libs/qcustomplot/qcustomplot.h \
     pumpinterface.h \
+    pumpstatus.h \
+    ratestreamer.h \
+    runjournal.h \
+    samplering.h \
+    serialframer.h \
     tablemodel.h \
     theming.h \
     utils.h
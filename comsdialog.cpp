@@ -11,6 +11,10 @@ COMsDialog::COMsDialog(QWidget *parent)
     //combo_com_pump->addItem("TEST");
     //combo_com_cond->addItem("TEST");
 
+    // Editable so a simulator pty (e.g. /tmp/ttyPumpSim) can be typed in
+    combo_com_pump->setEditable(true);
+    combo_com_cond->setEditable(true);
+
     for (const QSerialPortInfo &info : QSerialPortInfo::availablePorts()) {
         QString port = info.portName();
         combo_com_pump->addItem(port);
@@ -1,68 +1,53 @@
 #include "condinterface.h"
 #include <QDebug>
 #include <QDateTime>
-#include <QMetaEnum>
 
-CondInterface::CondInterface(QObject* parent) : QObject(parent), serial(new QSerialPort(this)) {
+CondInterface::CondInterface(QObject* parent) : QObject(parent) {
     qDebug() << "Creating CondInterface";
-    connect(serial, &QSerialPort::readyRead, this, &CondInterface::handleReadyRead);
-    connect(serial, &QSerialPort::errorOccurred, this, &CondInterface::handleError);
 
     workerThread = new QThread;
-    condWorker = new CondWorker(this, nullptr);
+    condWorker = new CondWorker(nullptr);
     condWorker->moveToThread(workerThread);
     workerThread->start();
-    QMetaObject::invokeMethod(condWorker, "initialize", Qt::QueuedConnection); //starts timer after moved
+    QMetaObject::invokeMethod(condWorker, "initialize", Qt::QueuedConnection); // creates port and timer after moved
 
     connect(this, &CondInterface::sendCommand, condWorker, &CondWorker::enqueueCommand, Qt::QueuedConnection);
-    connect(condWorker, &CondWorker::condCommandReady, this, &CondInterface::handleCommand, Qt::QueuedConnection);
+    connect(condWorker, &CondWorker::measurementReceived, this, &CondInterface::measurementReceived, Qt::QueuedConnection);
+    connect(condWorker, &CondWorker::messageReceived, this, &CondInterface::messageReceived, Qt::QueuedConnection);
+    connect(condWorker, &CondWorker::errorOccurred, this, &CondInterface::errorOccurred, Qt::QueuedConnection);
+    connect(condWorker, &CondWorker::samplingChanged, this, &CondInterface::samplingChanged, Qt::QueuedConnection);
+    connect(condWorker, &CondWorker::samplingStats, this, &CondInterface::samplingStats, Qt::QueuedConnection);
 
 }
 
 void CondInterface::shutdown() {
     if (workerThread) {
+        // this is equivalent to closePort(), on the thread that owns the port
+        QMetaObject::invokeMethod(condWorker, "closePort", Qt::BlockingQueuedConnection);
         workerThread->quit();
         workerThread->wait();
+        delete condWorker;
+        condWorker = nullptr;
         delete workerThread;
         workerThread = nullptr;
     }
-    // this is equivalent to closePort()
-    if (serial->isOpen()) {
-        serial->close();
-    }
 }
 
 CondInterface::~CondInterface() {
     shutdown();
 }
 
-void CondInterface::handleCommand(const QString& cmd)
-{
-    sendToMeter(cmd);
-}
-
 
 bool CondInterface::connectToMeter(const QString &portName, qint32 baudRate) {
-    if (serial->isOpen()) {
-        serial->close();
-    }
-
-    serial->setPortName(portName);
-    serial->setBaudRate(baudRate);
-    serial->setDataBits(QSerialPort::Data8);
-    serial->setParity(QSerialPort::NoParity);
-    serial->setStopBits(QSerialPort::OneStop);
-    serial->setFlowControl(QSerialPort::NoFlowControl);
-
-    if (!serial->open(QIODevice::ReadWrite)) {
-        emit errorOccurred("Failed to open port: " + serial->errorString());
+    if (!condWorker) {
         return false;
     }
 
-    serial->setDataTerminalReady(true);
-    serial->setRequestToSend(true);
-
-    //qDebug() << "Meter port opened successfully:" << serial->portName();
+    // Blocks until the worker thread has the port open (or failed to)
+    bool opened = false;
+    QMetaObject::invokeMethod(condWorker, [this, portName, baudRate]() {
+        return condWorker->openPort(portName, baudRate);
+    }, Qt::BlockingQueuedConnection, &opened);
 
     // Every time we connect, just confirm the datetime is set.
     //QDateTime now = QDateTime::currentDateTime();
@@ -73,78 +58,24 @@ bool CondInterface::connectToMeter(const QString &portName, qint32 baudRate) {
     //                      .arg(now.time().hour(), 2, 10, QChar('0'))
     //                      .arg(now.time().minute(), 2, 10, QChar('0'))
     //                      .arg(now.time().second(), 2, 10, QChar('0'));
-    //condWorker->enqueueCommand(command);
-    return true;
+    //emit sendCommand(command);
+    return opened;
 }
 
 void CondInterface::getMeasurement()
 {
     //qDebug() << "CONDINTERFACE: Emitting measurement request";
-    QString cmd = "GETMEAS\r";
-    emit sendCommand(cmd);
+    QMetaObject::invokeMethod(condWorker, "requestMeasurement", Qt::QueuedConnection);
 }
 
-bool CondInterface::sendToMeter(const QString &cmd)
+void CondInterface::startSampling(int periodMs)
 {
-    //qDebug() << "CondInterface sending to serial port";
-    QByteArray packet = cmd.toUtf8();
-    qint64 bytesWritten = serial->write(packet);
-    return bytesWritten == packet.size();
-
+    QMetaObject::invokeMethod(condWorker, [this, periodMs]() {
+        condWorker->startSampling(periodMs);
+    }, Qt::QueuedConnection);
 }
 
-void CondInterface::handleReadyRead() {
-    serialBuffer.append(serial->readAll());
-
-    while (true) {
-        int endIndex = serialBuffer.indexOf('>');
-
-        if (endIndex == -1)
-            break; // No full response yet
-
-        QByteArray frame = serialBuffer.left(endIndex + 1);  // Include '>'
-        serialBuffer.remove(0, endIndex + 1);                // Remove from buffer
-
-        QString response = QString::fromLatin1(frame).trimmed();
-        //qDebug() << "Parsed response:" << response;
-
-        if (response.contains("RTC updated")) {
-            emit messageReceived(response);
-        }
-        else if (response.contains("Conductivity")) {
-            //qDebug()<<"Measurement detected";
-            QStringList fields = response.split(',');
-
-            if (fields.size() >= 12) {
-                CondReading reading;
-                reading.value = fields[9].toDouble();         // e.g., "0.00"
-                reading.units = fields[10].trimmed();          // e.g., "uS/cm"
-
-                //qDebug() << "Conductivity reading:" << reading.value << reading.units;
-                emit measurementReceived(reading);
-            } else {
-                emit errorOccurred("Malformed GETMEAS response");
-            }
-        }
-        else {
-            emit messageReceived("Unknown response: " + response);
-        }
-    }
-}
-
-void CondInterface::handleError(QSerialPort::SerialPortError error) {
-    if (error != QSerialPort::NoError) {
-        // Get error name as string
-        const QMetaObject &mo = QSerialPort::staticMetaObject;
-        int index = mo.indexOfEnumerator("SerialPortError");
-        QMetaEnum metaEnum = mo.enumerator(index);
-        QString errorStr = QString::fromLatin1(metaEnum.valueToKey(error));
-
-        qWarning() << "Serial error occurred:" << errorStr << "(" << error << ")";
-
-        if (error == QSerialPort::ResourceError) {
-            serial->close();
-            emit errorOccurred(errorStr);  // You might want to pass the string too
-        }
-    }
+void CondInterface::stopSampling()
+{
+    QMetaObject::invokeMethod(condWorker, "stopSampling", Qt::QueuedConnection);
 }
@@ -9,8 +9,7 @@
 // This particular conductivity meter (Thermo Orion Lab Star EC112) is not great and has very minimal USB connectivity.
 // I can basically only call GETMEAS, which gets a measurement, so that's what I'll be programming!
 // Originally, I had the software set the current time on connect; may add that back.
-
-// Simple struct to hold a conductivity measurement
+// The port itself lives on CondWorker's thread; this is just the GUI-side handle.
 
 
 
@@ -21,29 +20,23 @@ public:
     ~CondInterface();
 
     bool connectToMeter(const QString &portName, qint32 baudRate = QSerialPort::Baud9600);
-    void getMeasurement();
+    void getMeasurement();                      // one-off, skipped if a request is already out
+    void startSampling(int periodMs);           // GETMEAS on a periodMs grid, see CondWorker
+    void stopSampling();
     void shutdown();
 
-public slots:
-    void handleCommand(const QString &cmd);
-
 
 signals:
     void messageReceived(const QString &data);
     void measurementReceived(CondReading reading);
     void errorOccurred(const QString &message);
+    void samplingChanged(int periodMs, double responseMs);
+    void samplingStats(double effectiveHz, double responseMs, int skipped, int timeouts);
     void sendCommand(const QString& cmd);
 
-private slots:
-    void handleReadyRead();
-    void handleError(QSerialPort::SerialPortError error);
-
 private:
-    bool sendToMeter(const QString &cmd);
     QThread *workerThread;
     CondWorker *condWorker;
-    QSerialPort *serial;
-    QByteArray serialBuffer;
 
 };
 
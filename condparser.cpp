@@ -0,0 +1,110 @@
+#include "condparser.h"
+
+#include <QByteArray>
+
+#include <cstring>
+
+namespace {
+
+constexpr int valueField = 9;
+constexpr int unitsField = 10;
+constexpr int minFields = 12;
+
+struct Field {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+};
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+Field trimmed(const char *begin, const char *end) {
+    while (begin < end && isSpace(*begin))
+        ++begin;
+    while (end > begin && isSpace(end[-1]))
+        --end;
+    return {begin, end};
+}
+
+bool equals(const Field &field, const char *text) {
+    size_t n = std::strlen(text);
+    return static_cast<size_t>(field.end - field.begin) == n && std::memcmp(field.begin, text, n) == 0;
+}
+
+bool contains(const char *data, int size, const char *text) {
+    int n = static_cast<int>(std::strlen(text));
+    for (int i = 0; i + n <= size; ++i) {
+        if (std::memcmp(data + i, text, static_cast<size_t>(n)) == 0)
+            return true;
+    }
+    return false;
+}
+
+CondUnits unitsFor(const Field &field) {
+    if (equals(field, "mS/cm"))
+        return CondUnits::MilliSiemens;
+    if (equals(field, "uS/cm"))
+        return CondUnits::MicroSiemens;
+    return CondUnits::Unknown;
+}
+
+} // namespace
+
+CondFrame parseCondFrame(const char *data, int size) {
+    CondFrame result;
+    Field value;
+    Field units;
+    bool conductivity = false;
+    int fields = 0;
+
+    const char *end = data + size;
+    const char *fieldStart = data;
+    for (const char *p = data; ; ++p) {
+        if (p != end && *p != ',')
+            continue;
+
+        Field field = trimmed(fieldStart, p);
+        if (fields == valueField)
+            value = field;
+        else if (fields == unitsField)
+            units = field;
+        else if (!conductivity && equals(field, "Conductivity"))
+            conductivity = true;
+        ++fields;
+
+        if (p == end)
+            break;
+        fieldStart = p + 1;
+    }
+
+    if (conductivity) {
+        result.kind = CondFrameKind::Malformed;
+        if (fields < minFields)
+            return result;
+        // Not std::from_chars: Apple's libc++ has no floating point overload.
+        // QByteArray::toDouble is always C locale, and a raw-data view doesn't
+        // copy the field.
+        bool ok = false;
+        double parsed = QByteArray::fromRawData(value.begin, static_cast<int>(value.end - value.begin)).toDouble(&ok);
+        if (!ok)
+            return result;
+        result.value = parsed;
+        result.units = unitsFor(units);
+        result.kind = CondFrameKind::Measurement;
+        return result;
+    }
+
+    // Not a report; the only other thing we ever ask for is the clock
+    result.kind = contains(data, size, "RTC updated") ? CondFrameKind::RtcUpdated : CondFrameKind::Other;
+    return result;
+}
+
+const char* condUnitsName(CondUnits units) {
+    switch (units) {
+    case CondUnits::MicroSiemens: return "uS/cm";
+    case CondUnits::MilliSiemens: return "mS/cm";
+    case CondUnits::Unknown:      break;
+    }
+    return "?";
+}
@@ -0,0 +1,41 @@
+#ifndef CONDPARSER_H
+#define CONDPARSER_H
+
+// Single-pass tokenizer for the EC112's GETMEAS report. Walks the raw frame
+// once, splitting on commas in place, and pulls out field 9 (value) and field
+// 10 (units) without building any strings, so CondWorker can fill a CondReading
+// straight from the framer's view.
+//
+// Example usage:
+//  CondFrame parsed = parseCondFrame(frame.data, frame.size);
+//  if (parsed.kind == CondFrameKind::Measurement) { ... parsed.value, parsed.units ... }
+
+enum class CondUnits : char {
+    Unknown,
+    MicroSiemens,   // uS/cm
+    MilliSiemens    // mS/cm
+};
+
+enum class CondFrameKind {
+    Measurement,
+    Malformed,      // a Conductivity report without the fields we need
+    RtcUpdated,
+    Other
+};
+
+struct CondFrame {
+    CondFrameKind kind = CondFrameKind::Other;
+    double value = 0.0;
+    CondUnits units = CondUnits::Unknown;
+};
+
+CondFrame parseCondFrame(const char *data, int size);
+
+const char* condUnitsName(CondUnits units);
+
+// Everything downstream (label, plot, saved runs) is in mS/cm
+inline double condToMilliSiemens(double value, CondUnits units) {
+    return units == CondUnits::MicroSiemens ? value / 1000.0 : value;
+}
+
+#endif // CONDPARSER_H
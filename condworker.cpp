@@ -1,26 +1,82 @@
 #include "condworker.h"
-#include "condinterface.h"
+#include "utils.h"
 #include <QDebug>
-#include <QApplication>
-
-CondWorker::CondWorker(CondInterface* interface, QObject* parent)
-    : QObject(parent), condInterface(interface) {
-
-    connect(condInterface, &CondInterface::measurementReceived,
-            this, &CondWorker::onResponseReceived);
+#include <QMetaEnum>
+#include <cmath>
 
+CondWorker::CondWorker(QObject* parent)
+    : QObject(parent), framer(0, '>') {
 }
 
 void CondWorker::initialize() {
+    // Created here so the port and timer belong to the worker thread
+    serial = new QSerialPort(this);
+    connect(serial, &QSerialPort::readyRead, this, &CondWorker::handleReadyRead);
+    connect(serial, &QSerialPort::errorOccurred, this, &CondWorker::handleError);
+
     timeoutTimer = new QTimer(this);
     timeoutTimer->setSingleShot(true);
-    timeoutTimer->setInterval(3000);
+    timeoutTimer->setInterval(timeoutMs);
 
     connect(timeoutTimer, &QTimer::timeout, this, [this]() {
         qWarning() << "Command timed out!";
+        if (current.startsWith("GETMEAS") && !requests.isEmpty()) {
+            // Its reply may still come; it mustn't be taken for the next one's
+            requests.last().abandoned = true;
+            ++statsTimeouts;
+            addResponseTime(timeoutMs);
+        }
+        current.clear();
         processing = false;
         processNext();
     });
+
+    sampleTimer = new QTimer(this);
+    sampleTimer->setSingleShot(true);
+    sampleTimer->setTimerType(Qt::PreciseTimer);
+    connect(sampleTimer, &QTimer::timeout, this, &CondWorker::onSampleDeadline);
+}
+
+bool CondWorker::openPort(const QString &portName, qint32 baudRate) {
+    if (serial->isOpen()) {
+        serial->close();
+    }
+    framer.clear();
+    commandQueue.clear();
+    requests.clear();
+    timeoutTimer->stop();
+    processing = false;
+
+    serial->setPortName(portName);
+    serial->setBaudRate(baudRate);
+    serial->setDataBits(QSerialPort::Data8);
+    serial->setParity(QSerialPort::NoParity);
+    serial->setStopBits(QSerialPort::OneStop);
+    serial->setFlowControl(QSerialPort::NoFlowControl);
+
+    if (!serial->open(QIODevice::ReadWrite)) {
+        emit errorOccurred("Failed to open port: " + serial->errorString());
+        return false;
+    }
+
+    serial->setDataTerminalReady(true);
+    serial->setRequestToSend(true);
+
+    //qDebug() << "Meter port opened successfully:" << serial->portName();
+    return true;
+}
+
+void CondWorker::closePort() {
+    stopSampling();
+    if (timeoutTimer) {
+        timeoutTimer->stop();
+    }
+    commandQueue.clear();
+    requests.clear();
+    processing = false;
+    if (serial && serial->isOpen()) {
+        serial->close();
+    }
 }
 
 void CondWorker::enqueueCommand(const QString &command) {
@@ -44,15 +100,206 @@ void CondWorker::processNext() {
         return;
     }
     QString cmd = commandQueue.dequeue();
-   // qDebug()<<"CondWorker returning command";
-    emit condCommandReady(cmd);
+    current = cmd;
+    if (!writeCommand(cmd)) {
+        emit errorOccurred("Failed to write to meter.");
+    }
     processing = true;
     timeoutTimer->start();
 }
 
-void CondWorker::onResponseReceived(CondReading response) {
-    Q_UNUSED(response)
+void CondWorker::requestMeasurement() {
+    // Never more than one GETMEAS at the meter or waiting for it
+    if ((processing && current.startsWith("GETMEAS")) || commandQueue.contains("GETMEAS\r")) {
+        ++statsSkipped;
+        return;
+    }
+    enqueueCommand("GETMEAS\r");
+}
+
+void CondWorker::startSampling(int periodMs) {
+    basePeriodMs = qMax(1, periodMs);
+    stride = 1;
+    samplingClock.start();
+    nextDeadline = 0;
+    statsStart = 0;
+    statsSamples = 0;
+    statsSkipped = 0;
+    statsTimeouts = 0;
+    onSampleDeadline();
+}
+
+void CondWorker::stopSampling() {
+    basePeriodMs = 0;
+    if (sampleTimer) {
+        sampleTimer->stop();
+    }
+}
+
+void CondWorker::onSampleDeadline() {
+    if (basePeriodMs <= 0) {
+        return;
+    }
+    requestMeasurement();
+    reportStats();
+    scheduleNextSample();
+}
+
+void CondWorker::scheduleNextSample() {
+    const qint64 now = samplingClock.elapsed();
+    const qint64 step = qint64(basePeriodMs) * stride;
+    nextDeadline += step;
+    if (nextDeadline <= now) {
+        // Thread was held up past a deadline: skip to the next slot on the grid
+        // instead of firing a burst to catch up
+        qint64 missed = (now - nextDeadline) / step + 1;
+        nextDeadline += missed * step;
+        statsSkipped += static_cast<int>(missed);
+    }
+    sampleTimer->start(static_cast<int>(nextDeadline - now));
+}
+
+void CondWorker::adaptStride() {
+    if (basePeriodMs <= 0 || responseMs < 0) {
+        return;
+    }
+    double needed = responseMs * responseHeadroom;
+    int wanted = qMax(1, static_cast<int>(std::ceil(needed / basePeriodMs)));
+    // Step out straight away, but only step back in once there's clear room,
+    // so a response time sitting on a boundary doesn't flip-flop
+    if (wanted > stride || (wanted < stride && needed < (stride - 1) * basePeriodMs * 0.8)) {
+        stride = wanted;
+        emit samplingChanged(basePeriodMs * stride, responseMs);
+    }
+}
+
+void CondWorker::reportStats() {
+    const qint64 now = samplingClock.elapsed();
+    if (now - statsStart < statsWindowMs) {
+        return;
+    }
+    double effectiveHz = statsSamples * 1000.0 / (now - statsStart);
+    emit samplingStats(effectiveHz, responseMs, statsSkipped, statsTimeouts);
+    statsStart = now;
+    statsSamples = 0;
+    statsSkipped = 0;
+    statsTimeouts = 0;
+}
+
+void CondWorker::addResponseTime(double ms) {
+    responseMs = responseMs < 0 ? ms : 0.8 * responseMs + 0.2 * ms;
+    adaptStride();
+}
+
+bool CondWorker::takeRequest(Request *matched) {
+    // Matches a GETMEAS reply to the oldest request still owed one. Returns
+    // false if that request was abandoned, i.e. this reply is a late one.
+    const qint64 now = utils::monotonicNs();
+    while (!requests.isEmpty() && requests.head().abandoned
+           && now - requests.head().sentNs > qint64(lateReplyMs) * 1000000) {
+        requests.dequeue();     // never answered, and won't be now
+    }
+    if (requests.isEmpty()) {
+        return false;           // nothing asked for this one
+    }
+    *matched = requests.dequeue();
+    return !matched->abandoned;
+}
+
+void CondWorker::onResponseReceived(qint64 requestedNs) {
+    if (current.startsWith("GETMEAS")) {
+        addResponseTime((utils::monotonicNs() - requestedNs) / 1e6);
+        ++statsSamples;
+    }
+    current.clear();
     timeoutTimer->stop();
     processing = false;
     processNext();
 }
+
+bool CondWorker::writeCommand(const QString &cmd)
+{
+    if (!serial || !serial->isOpen()) {
+        return false;
+    }
+    //qDebug() << "CondWorker sending to serial port";
+    QByteArray packet = cmd.toUtf8();
+    if (cmd.startsWith("GETMEAS")) {
+        // The reply is stamped with this, however late it comes or whatever is written meanwhile
+        Request request;
+        request.sentNs = utils::monotonicNs();
+        requests.enqueue(request);
+    }
+    qint64 bytesWritten = serial->write(packet);
+    return bytesWritten == packet.size();
+}
+
+void CondWorker::handleReadyRead() {
+    while (serial->bytesAvailable() > 0) {
+        int room = 0;
+        char *dst = framer.writePtr(&room);
+        qint64 n = serial->read(dst, room);
+        if (n <= 0)
+            break;
+        framer.commit(static_cast<int>(n));
+        // Every frame completed by this read arrived (as far as we can tell) now
+        const qint64 receivedNs = utils::monotonicNs();
+
+        FrameView frame;
+        while (framer.next(frame)) {
+            handleFrame(frame, receivedNs);
+        }
+    }
+}
+
+void CondWorker::handleFrame(const FrameView &frame, qint64 receivedNs) {
+    // Parsed straight off the framer's bytes; only the rare non-measurement frames become strings
+    CondFrame parsed = parseCondFrame(frame.data, frame.size);
+
+    Request request;
+    if ((parsed.kind == CondFrameKind::Measurement || parsed.kind == CondFrameKind::Malformed) && !takeRequest(&request)) {
+        // Late reply to a request that already timed out (or one nobody made)
+        return;
+    }
+
+    switch (parsed.kind) {
+    case CondFrameKind::Measurement: {
+        CondReading reading;
+        reading.value = parsed.value;
+        reading.units = parsed.units;
+        reading.requestedNs = request.sentNs;
+        reading.receivedNs = receivedNs;
+        //qDebug() << "Conductivity reading:" << reading.value << condUnitsName(reading.units);
+        emit measurementReceived(reading);
+        onResponseReceived(request.sentNs);
+        break;
+    }
+    case CondFrameKind::Malformed:
+        emit errorOccurred("Malformed GETMEAS response");
+        onResponseReceived(request.sentNs);
+        break;
+    case CondFrameKind::RtcUpdated:
+        emit messageReceived(QString::fromLatin1(frame.data, frame.size).trimmed());
+        break;
+    case CondFrameKind::Other:
+        emit messageReceived("Unknown response: " + QString::fromLatin1(frame.data, frame.size).trimmed());
+        break;
+    }
+}
+
+void CondWorker::handleError(QSerialPort::SerialPortError error) {
+    if (error != QSerialPort::NoError) {
+        // Get error name as string
+        const QMetaObject &mo = QSerialPort::staticMetaObject;
+        int index = mo.indexOfEnumerator("SerialPortError");
+        QMetaEnum metaEnum = mo.enumerator(index);
+        QString errorStr = QString::fromLatin1(metaEnum.valueToKey(error));
+
+        qWarning() << "Serial error occurred:" << errorStr << "(" << error << ")";
+
+        if (error == QSerialPort::ResourceError) {
+            serial->close();
+            emit errorOccurred(errorStr);  // You might want to pass the string too
+        }
+    }
+}
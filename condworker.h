@@ -2,49 +2,114 @@
 #define CONDWORKER_H
 
 #include <QObject>
+#include <QElapsedTimer>
 #include <QQueue>
-#include <QTime>
+#include <QSerialPort>
 #include <QTimer>
+#include "condparser.h"
+#include "serialframer.h"
 
-// Queues the commands used by CondInterface for sending to meter.
+// Queues the commands used by CondInterface for sending to meter, and owns the
+// meter's serial port so reads/writes never wait on the GUI thread.
 // Used exact same layout as PumpCommandWorker
-
-class CondInterface;
+//
+// GETMEAS is scheduled here too. Samples are requested on a fixed grid of
+// deadlines (multiples of the protocol's dt from when sampling started), and
+// there's never more than one request at the meter: a deadline that comes up
+// while the last one is still out is skipped, not queued. The meter's response
+// time is tracked, and if it can't keep up with dt the sampler steps out to
+// every 2nd, 3rd... grid point instead, so samples stay on the protocol clock
+// rather than sliding later and later.
+//
+// The meter answers in order, so GETMEAS requests are matched to replies
+// through a queue of the ones written. One that times out stays in the queue
+// as abandoned: if its reply turns up late it's thrown away instead of passing
+// for the next request's. Abandoned entries older than lateReplyMs are taken
+// as lost for good. A timeout also counts as a very slow response, so the
+// stride steps out for a meter that has stopped answering.
 
 struct CondReading {
     double value = 0.0;
-    QString units;
-    QTime timestamp;
+    CondUnits units = CondUnits::Unknown;
+    qint64 requestedNs = 0;     // utils::monotonicNs() when GETMEAS was written
+    qint64 receivedNs = 0;      // ... and when the reply's '>' arrived
 
-    CondReading() = default;
+    double latencyMs() const { return (receivedNs - requestedNs) / 1e6; }
+};
 
-    CondReading(double v, const QString& u, const QTime& t = QTime::currentTime())
-        : value(v), units(u), timestamp(t) {}
+// What the plot and saved runs keep of a reading
+struct CondSample {
+    qint64 t = 0;               // requestedNs: the meter is asked on the sampling grid
+    double value = 0.0;         // mS/cm
 };
 
 class CondWorker : public QObject
 {
     Q_OBJECT
 public:
-    explicit CondWorker(CondInterface* interface, QObject* parent = nullptr);
+    explicit CondWorker(QObject* parent = nullptr);
 
 signals:
-    void condCommandReady(QString cmd);
-
+    void messageReceived(const QString &data);
+    void measurementReceived(CondReading reading);
+    void errorOccurred(const QString &message);
+    void samplingChanged(int periodMs, double responseMs);  // stepped to a different grid stride
+    void samplingStats(double effectiveHz, double responseMs, int skipped, int timeouts);
 
 public slots:
-    void enqueueCommand(const QString& cmd);public slots:
-    void initialize();  // slot to set up the timer
+    void initialize();  // slot to set up the port and timer
+    bool openPort(const QString &portName, qint32 baudRate);
+    void closePort();
+    void enqueueCommand(const QString& cmd);
+    void requestMeasurement();              // dropped if one is already out
+    void startSampling(int periodMs);
+    void stopSampling();
 
 private slots:
-    void onResponseReceived(CondReading response);
+    void handleReadyRead();
+    void handleError(QSerialPort::SerialPortError error);
 
 private:
+    struct Request {
+        qint64 sentNs = 0;              // utils::monotonicNs() when it was written
+        bool abandoned = false;         // timed out; a reply to it is dropped
+    };
+
     void processNext();
-    QTimer* timeoutTimer;
+    void onResponseReceived(qint64 requestedNs);
+    void handleFrame(const FrameView &frame, qint64 receivedNs);
+    bool writeCommand(const QString &cmd);
+    void onSampleDeadline();
+    void scheduleNextSample();
+    void adaptStride();
+    void addResponseTime(double ms);
+    bool takeRequest(Request *matched);
+    void reportStats();
+
+    static constexpr double responseHeadroom = 1.25;   // period has to beat the response time by this much
+    static constexpr int statsWindowMs = 5000;
+    static constexpr int timeoutMs = 3000;
+    static constexpr int lateReplyMs = 2 * timeoutMs;   // an abandoned request's reply won't come after this
+
+    QSerialPort* serial = nullptr;
+    SerialFramer framer;
+    QTimer* timeoutTimer = nullptr;
     QQueue<QString> commandQueue;
-    CondInterface* condInterface;
     bool processing = false;
+    QString current;
+    QQueue<Request> requests;       // GETMEAS written and not answered yet, oldest first
+
+    // Sampling
+    QTimer* sampleTimer = nullptr;
+    QElapsedTimer samplingClock;
+    qint64 nextDeadline = 0;        // ms on samplingClock
+    int basePeriodMs = 0;           // 0 = not sampling
+    int stride = 1;                 // sample every stride-th grid point
+    double responseMs = -1;         // EWMA, -1 until the first reply
+    qint64 statsStart = 0;
+    int statsSamples = 0;
+    int statsSkipped = 0;
+    int statsTimeouts = 0;
 };
 
 #endif // CONDWORKER_H
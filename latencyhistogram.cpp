@@ -0,0 +1,57 @@
+#include "latencyhistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+int LatencyHistogram::bucketFor(double ms) {
+    if (!(ms > minMs))
+        return 0;
+    int bucket = static_cast<int>(std::floor(std::log2(ms / minMs) * 4)) + 1;
+    return std::min(bucket, bucketCount - 1);
+}
+
+double LatencyHistogram::upperEdge(int bucket) {
+    return minMs * std::exp2(bucket / 4.0);
+}
+
+void LatencyHistogram::add(double ms) {
+    if (ms < 0)
+        ms = 0;
+    ++buckets[static_cast<size_t>(bucketFor(ms))];
+    ++samples;
+    total += ms;
+    largest = std::max(largest, ms);
+}
+
+void LatencyHistogram::clear() {
+    buckets.fill(0);
+    samples = 0;
+    total = 0;
+    largest = 0;
+}
+
+std::int64_t LatencyHistogram::count() const {
+    return samples;
+}
+
+double LatencyHistogram::mean() const {
+    return samples ? total / samples : 0;
+}
+
+double LatencyHistogram::max() const {
+    return largest;
+}
+
+double LatencyHistogram::percentile(double fraction) const {
+    if (samples == 0)
+        return 0;
+    std::int64_t rank = static_cast<std::int64_t>(std::ceil(fraction * samples));
+    rank = std::clamp<std::int64_t>(rank, 1, samples);
+    std::int64_t seen = 0;
+    for (int i = 0; i < bucketCount; ++i) {
+        seen += buckets[static_cast<size_t>(i)];
+        if (seen >= rank)
+            return i == bucketCount - 1 ? largest : std::min(upperEdge(i), largest);
+    }
+    return largest;
+}
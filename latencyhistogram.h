@@ -0,0 +1,38 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <array>
+#include <cstdint>
+
+// Fixed-size latency histogram with quarter-octave buckets from 0.1 ms to
+// about 400 s, so adding a sample is a log and an increment and percentiles
+// come out within ~19% of the true value. Cheap enough to feed every reading.
+//
+// Example usage:
+//  histogram.add(reading.latencyMs());
+//  histogram.percentile(0.95);
+
+class LatencyHistogram {
+public:
+    void add(double ms);
+    void clear();
+
+    std::int64_t count() const;
+    double mean() const;
+    double max() const;
+    double percentile(double fraction) const;   // 0.5 = median; upper edge of the bucket
+
+private:
+    static constexpr int bucketCount = 88;      // 22 octaves
+    static constexpr double minMs = 0.1;
+
+    static int bucketFor(double ms);
+    static double upperEdge(int bucket);
+
+    std::array<std::int64_t, bucketCount> buckets{};
+    std::int64_t samples = 0;
+    double total = 0;
+    double largest = 0;
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,205 @@
+#include "lodseries.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr int maxLevels = 12;           // 4^12 = 16M points per bucket
+
+int bucketSize(int level) {
+    // level 0 in `levels` is fanout^1
+    return 1 << (2 * (level + 1));
+}
+
+} // namespace
+
+void LodSeries::clear() {
+    xs.clear();
+    ys.clear();
+    levels.clear();
+    begin = 0;
+}
+
+void LodSeries::set(const double *x, const double *y, int count) {
+    clear();
+    xs.assign(x, x + count);
+    ys.assign(y, y + count);
+    rebuild();
+}
+
+void LodSeries::append(double x, double y) {
+    xs.push_back(x);
+    ys.push_back(y);
+    addToLevels(static_cast<int>(xs.size()) - 1);
+}
+
+void LodSeries::addToLevels(int index) {
+    const double x = xs[static_cast<size_t>(index)];
+    const double y = ys[static_cast<size_t>(index)];
+    for (int level = 0; level < maxLevels; ++level) {
+        if (index + 1 < bucketSize(level) && static_cast<int>(levels.size()) <= level) {
+            // Not enough points for a bucket this size yet, so none for bigger ones either
+            break;
+        }
+        if (static_cast<int>(levels.size()) <= level) {
+            // First time this level is worth having: build it from the raw points
+            levels.emplace_back();
+            const int size = bucketSize(level);
+            for (int from = 0; from <= index; from += size) {
+                levels.back().push_back(rawBucket(from, std::min(from + size, index + 1)));
+            }
+            continue;
+        }
+        std::vector<Bucket> &buckets = levels[static_cast<size_t>(level)];
+        const size_t bucket = static_cast<size_t>(index / bucketSize(level));
+        if (bucket == buckets.size()) {
+            buckets.push_back({x, y, x, y});
+        } else {
+            Bucket &b = buckets[bucket];
+            if (y < b.yMin) { b.yMin = y; b.xMin = x; }
+            if (y > b.yMax) { b.yMax = y; b.xMax = x; }
+        }
+    }
+}
+
+void LodSeries::rebuild() {
+    levels.clear();
+    const int n = static_cast<int>(xs.size());
+    for (int level = 0; level < maxLevels && bucketSize(level) <= n; ++level) {
+        const int size = bucketSize(level);
+        std::vector<Bucket> buckets;
+        buckets.reserve(static_cast<size_t>((n + size - 1) / size));
+        for (int from = 0; from < n; from += size) {
+            buckets.push_back(rawBucket(from, std::min(from + size, n)));
+        }
+        levels.push_back(std::move(buckets));
+    }
+}
+
+LodSeries::Bucket LodSeries::rawBucket(int from, int to) const {
+    Bucket b{xs[static_cast<size_t>(from)], ys[static_cast<size_t>(from)],
+             xs[static_cast<size_t>(from)], ys[static_cast<size_t>(from)]};
+    for (int i = from + 1; i < to; ++i) {
+        const double y = ys[static_cast<size_t>(i)];
+        if (y < b.yMin) { b.yMin = y; b.xMin = xs[static_cast<size_t>(i)]; }
+        if (y > b.yMax) { b.yMax = y; b.xMax = xs[static_cast<size_t>(i)]; }
+    }
+    return b;
+}
+
+void LodSeries::shiftX(double dx) {
+    for (double &x : xs) {
+        x += dx;
+    }
+    for (std::vector<Bucket> &buckets : levels) {
+        for (Bucket &b : buckets) {
+            b.xMin += dx;
+            b.xMax += dx;
+        }
+    }
+}
+
+void LodSeries::trimBefore(double x) {
+    const int n = static_cast<int>(xs.size());
+    while (begin < n && xs[static_cast<size_t>(begin)] <= x) {
+        ++begin;
+    }
+    // Dead points are only compacted once they're half the store, so trimming
+    // one point per sample stays O(1) amortized
+    if (begin > 0 && begin * 2 >= n) {
+        xs.erase(xs.begin(), xs.begin() + begin);
+        ys.erase(ys.begin(), ys.begin() + begin);
+        begin = 0;
+        rebuild();
+    }
+}
+
+int LodSeries::size() const {
+    return static_cast<int>(xs.size()) - begin;
+}
+
+bool LodSeries::isEmpty() const {
+    return size() == 0;
+}
+
+double LodSeries::firstX() const {
+    return xs[static_cast<size_t>(begin)];
+}
+
+double LodSeries::lastX() const {
+    return xs.back();
+}
+
+int LodSeries::lowerIndex(double x) const {
+    auto it = std::lower_bound(xs.begin() + begin, xs.end(), x);
+    return static_cast<int>(it - xs.begin());
+}
+
+void LodSeries::extract(double x0, double x1, int maxPoints, std::vector<double> &keys, std::vector<double> &values) const {
+    keys.clear();
+    values.clear();
+    if (isEmpty()) {
+        return;
+    }
+
+    const int n = static_cast<int>(xs.size());
+    // One point either side of the window so the line reaches the axis edges
+    const int from = std::max(begin, lowerIndex(x0) - 1);
+    const int past = static_cast<int>(std::upper_bound(xs.begin() + begin, xs.end(), x1) - xs.begin());
+    const int to = std::min(n, past + 1);           // exclusive
+    const int count = to - from;
+    if (count <= 0) {
+        return;
+    }
+
+    // Coarsest level is the smallest one that fits; two points per bucket
+    int level = -1;
+    while (level + 1 < static_cast<int>(levels.size()) && 2 * count / (level < 0 ? 1 : bucketSize(level)) > maxPoints) {
+        ++level;
+    }
+
+    if (level < 0) {
+        keys.assign(xs.begin() + from, xs.begin() + to);
+        values.assign(ys.begin() + from, ys.begin() + to);
+        return;
+    }
+
+    const int size = bucketSize(level);
+    const std::vector<Bucket> &buckets = levels[static_cast<size_t>(level)];
+    keys.reserve(static_cast<size_t>(2 * (count / size + 2)));
+    values.reserve(keys.capacity());
+
+    auto push = [&keys, &values](const Bucket &b) {
+        // Min and max in the order they happened, so the line's shape is kept
+        if (b.xMin == b.xMax) {
+            keys.push_back(b.xMin);
+            values.push_back(b.yMin);
+        } else if (b.xMin < b.xMax) {
+            keys.push_back(b.xMin); values.push_back(b.yMin);
+            keys.push_back(b.xMax); values.push_back(b.yMax);
+        } else {
+            keys.push_back(b.xMax); values.push_back(b.yMax);
+            keys.push_back(b.xMin); values.push_back(b.yMin);
+        }
+    };
+
+    // Buckets that straddle a trimmed front or the window edges are done from
+    // the raw points so nothing outside [from, to) leaks in
+    int i = from;
+    const int firstFull = (from + size - 1) / size;
+    const int lastFull = to / size;               // exclusive
+    if (firstFull >= lastFull) {
+        push(rawBucket(from, to));
+        return;
+    }
+    if (i < firstFull * size) {
+        push(rawBucket(i, firstFull * size));
+    }
+    for (int b = firstFull; b < lastFull; ++b) {
+        push(buckets[static_cast<size_t>(b)]);
+    }
+    i = lastFull * size;
+    if (i < to) {
+        push(rawBucket(i, to));
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef LODSERIES_H
+#define LODSERIES_H
+
+#include <vector>
+
+// Level-of-detail store for one plotted series. Level 0 is the raw points;
+// each level above it keeps, per bucket of fanout^level raw points, the
+// minimum and maximum and where they were. extract() picks the coarsest level
+// that still gives about one bucket per pixel across the visible x range, so a
+// six hour run zoomed out draws a few thousand points (with every spike kept),
+// and zoomed in draws the raw data.
+//
+// x has to be non-decreasing. append() touches one bucket per level.
+//
+// Example usage:
+//  series.append(x, y);
+//  series.extract(xAxis->range().lower, xAxis->range().upper, 2 * pixelWidth, keys, values);
+
+class LodSeries {
+public:
+    static constexpr int fanout = 4;
+
+    void clear();
+    void set(const double *x, const double *y, int count);
+    void append(double x, double y);
+    void shiftX(double dx);
+    void trimBefore(double x);          // drops points with x <= the given one
+
+    int size() const;
+    bool isEmpty() const;
+    double firstX() const;
+    double lastX() const;
+    const std::vector<double>& rawX() const { return xs; }
+    const std::vector<double>& rawY() const { return ys; }
+
+    // Replaces keys/values with at most ~maxPoints points covering [x0, x1],
+    // plus one neighbour on each side so lines run off the edges
+    void extract(double x0, double x1, int maxPoints, std::vector<double> &keys, std::vector<double> &values) const;
+
+private:
+    struct Bucket {
+        double xMin, yMin;
+        double xMax, yMax;
+    };
+
+    void addToLevels(int index);
+    void rebuild();
+    int lowerIndex(double x) const;
+    Bucket rawBucket(int from, int to) const;
+
+    std::vector<double> xs;
+    std::vector<double> ys;
+    int begin = 0;                                  // trimmed points before this are dead
+    std::vector<std::vector<Bucket>> levels;        // levels[0] is fanout^1
+};
+
+#endif // LODSERIES_H
@@ -0,0 +1,151 @@
+#include "phasecompiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+bool sameRate(double a, double b) {
+    return std::abs(a - b) <= 1e-6 * std::max(1.0, std::max(std::abs(a), std::abs(b)));
+}
+
+bool isHold(const PhaseSpan &span) {
+    return sameRate(span.startRate, span.endRate);
+}
+
+bool canMerge(const PhaseSpan &prev, const PhaseSpan &next) {
+    if (isHold(prev) && isHold(next)) {
+        return sameRate(prev.startRate, next.startRate);
+    }
+    if (isHold(prev) || isHold(next) || !sameRate(prev.endRate, next.startRate)) {
+        return false;
+    }
+    // A ramp that carries straight on
+    double prevSlope = (prev.endRate - prev.startRate) / prev.seconds;
+    double nextSlope = (next.endRate - next.startRate) / next.seconds;
+    return sameRate(prevSlope, nextSlope);
+}
+
+QString twoFields(int first, int second) {
+    return QString("%1:%2").arg(first, 2, 10, QLatin1Char('0')).arg(second, 2, 10, QLatin1Char('0'));
+}
+
+class Emitter {
+public:
+    explicit Emitter(int firstPhase) : next(firstPhase) {}
+
+    void hold(const PhaseSpan &span) {
+        PumpPhase phase;
+        phase.function = "RAT";
+        phase.rate = span.startRate;
+        phase.volume = span.startRate * span.seconds / 60.0;
+        add(phase);
+    }
+
+    void ramp(const PhaseSpan &span) {
+        // LIN takes its time across the pair: HH:MM on the first phase, SS:tenths on the second
+        long long tenths = std::llround(span.seconds * 10);
+        int hours = static_cast<int>(tenths / 36000);
+        int minutes = static_cast<int>(tenths / 600 % 60);
+        int seconds = static_cast<int>(tenths / 10 % 60);
+
+        PumpPhase start;
+        start.function = "LIN";
+        start.rate = span.startRate;
+        start.time = twoFields(hours, minutes);
+        add(start);
+
+        PumpPhase end;
+        end.function = "LIN";
+        end.rate = span.endRate;
+        end.time = twoFields(seconds, static_cast<int>(tenths % 10));
+        add(end);
+    }
+
+    void pause(long long seconds) {
+        const PausePlan plan = planPause(seconds);
+        for (int i = 0; i < plan.longLoops; ++i) {
+            loop(maxPauseSeconds, maxLoopCount);
+        }
+        if (plan.loopPasses > 0) {
+            loop(plan.loopSeconds, plan.loopPasses);
+        }
+        for (int chunk : plan.pauses) {
+            if (chunk > 0) {
+                pauseOnce(chunk);
+            }
+        }
+    }
+
+    void stop() {
+        PumpPhase phase;
+        phase.function = "STOP";
+        add(phase);
+    }
+
+    PhaseProgram program;
+
+private:
+    void add(PumpPhase phase) {
+        phase.phaseNumber = next++;
+        program.phases.append(phase);
+        program.lastPhase = phase.phaseNumber;
+    }
+
+    void pauseOnce(int seconds) {
+        PumpPhase phase;
+        phase.function = "PAUSE";
+        phase.time = QString::number(seconds);
+        add(phase);
+    }
+
+    void loop(int seconds, int passes) {
+        PumpPhase start;
+        start.function = "LOOP";
+        add(start);
+        pauseOnce(seconds);
+        PumpPhase end;
+        end.function = "ENDLOOP";
+        end.time = QString::number(loopEndCount(passes));
+        add(end);
+    }
+
+    int next;
+};
+
+} // namespace
+
+PhaseProgram compilePumpPhases(int firstPhase, const QVector<PhaseSpan> &spans, bool stopAtEnd)
+{
+    QVector<PhaseSpan> merged;
+    merged.reserve(spans.size());
+    int mergeCount = 0;
+    for (const PhaseSpan &span : spans) {
+        if (span.seconds <= 0) {
+            continue;
+        }
+        if (!merged.isEmpty() && canMerge(merged.last(), span)) {
+            merged.last().seconds += span.seconds;
+            merged.last().endRate = span.endRate;
+            ++mergeCount;
+        } else {
+            merged.append(span);
+        }
+    }
+
+    Emitter emitter(firstPhase);
+    for (const PhaseSpan &span : merged) {
+        if (!isHold(span)) {
+            emitter.ramp(span);
+        } else if (span.startRate > 0) {
+            emitter.hold(span);
+        } else {
+            emitter.pause(std::llround(span.seconds));
+        }
+    }
+    if (stopAtEnd) {
+        emitter.stop();
+    }
+    emitter.program.merged = mergeCount;
+    return emitter.program;
+}
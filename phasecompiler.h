@@ -0,0 +1,110 @@
+#ifndef PHASECOMPILER_H
+#define PHASECOMPILER_H
+
+#include <QVector>
+
+#include "pumpcommands.h"
+
+// Turns one pump's share of the protocol into its phase program. Adjacent
+// spans that run the same way are merged first (equal holds, pauses, and
+// ramps that carry on at the same slope), then each span is encoded in as few
+// phases as possible: a hold is one RAT, a ramp is the usual LIN pair, and a
+// pause longer than 99 s becomes a LPS/PAS/LPE loop instead of a chain of
+// 99 s PAUSE phases.
+//
+// Example usage:
+//  PhaseProgram program = compilePumpPhases(2, spans, true);
+//  if (program.lastPhase > maxPumpPhases) { ... too long ... }
+
+constexpr int maxPumpPhases = 40;       // NE-1002X program memory
+constexpr int maxPauseSeconds = 99;
+constexpr int maxLoopCount = 99;
+
+// Loop counts. LPE nn sends the pump back to its LPS until the body has run
+// nn times in all, so "LPS, PAS 99, LPE 6" pauses for 6 x 99 s. That's how
+// pumpsim executes LPE too; everything that turns a count into time goes
+// through these two, so a firmware that counts repeats instead (nn + 1 passes)
+// only needs them changed.
+constexpr int loopEndCount(int passes) {
+    return passes;
+}
+
+constexpr long long loopedSeconds(int bodySeconds, int count) {
+    return static_cast<long long>(bodySeconds) * count;
+}
+
+// How a pause is split up: whole loops of the longest pause first, then
+// either up to three plain PAUSEs (a loop costs three phases, so those are no
+// worse) or one loop, exact if some length divides what's left, plus at most
+// one short PAUSE.
+struct PausePlan {
+    int longLoops = 0;                  // of maxPauseSeconds x maxLoopCount
+    int loopSeconds = 0;                // then one loop of loopSeconds x loopPasses,
+    int loopPasses = 0;                 // if loopPasses > 0
+    int pauses[3] = {0, 0, 0};          // then plain PAUSEs, 0 = unused
+};
+
+constexpr PausePlan planPause(long long seconds) {
+    PausePlan plan;
+    const long long loopMax = static_cast<long long>(maxPauseSeconds) * maxLoopCount;
+    while (seconds > loopMax) {
+        ++plan.longLoops;
+        seconds -= loopMax;
+    }
+    if (seconds <= 0) {
+        return plan;
+    }
+    if (seconds <= 3LL * maxPauseSeconds) {
+        for (int i = 0; seconds > 0; ++i) {
+            plan.pauses[i] = static_cast<int>(seconds < maxPauseSeconds ? seconds : maxPauseSeconds);
+            seconds -= plan.pauses[i];
+        }
+        return plan;
+    }
+    for (int length = maxPauseSeconds; length * maxLoopCount >= seconds && length > 1; --length) {
+        if (seconds % length == 0) {
+            plan.loopSeconds = length;
+            plan.loopPasses = static_cast<int>(seconds / length);
+            return plan;
+        }
+    }
+    plan.loopSeconds = maxPauseSeconds;
+    plan.loopPasses = static_cast<int>(seconds / maxPauseSeconds);
+    plan.pauses[0] = static_cast<int>(seconds % maxPauseSeconds);
+    return plan;
+}
+
+// What the pump actually waits for when it runs a plan
+constexpr long long plannedSeconds(const PausePlan &plan) {
+    long long total = plan.longLoops * loopedSeconds(maxPauseSeconds, loopEndCount(maxLoopCount));
+    if (plan.loopPasses > 0) {
+        total += loopedSeconds(plan.loopSeconds, loopEndCount(plan.loopPasses));
+    }
+    return total + plan.pauses[0] + plan.pauses[1] + plan.pauses[2];
+}
+
+// Worked examples, checked at compile time: a 10 min pause is 8 x 75 s, a
+// prime length gets a loop plus a remainder, and a long one starts with full
+// 99 x 99 s loops.
+static_assert(planPause(600).loopSeconds == 75 && planPause(600).loopPasses == 8, "600 s pause should be 8 x 75 s");
+static_assert(loopEndCount(planPause(600).loopPasses) == 8, "600 s pause should end its loop with LPE 8");
+static_assert(plannedSeconds(planPause(600)) == 600, "600 s pause");
+static_assert(plannedSeconds(planPause(250)) == 250 && planPause(250).loopPasses == 0, "250 s is three plain PAUSEs");
+static_assert(plannedSeconds(planPause(1009)) == 1009, "prime pause length");
+static_assert(plannedSeconds(planPause(25000)) == 25000 && planPause(25000).longLoops == 2, "pause longer than one full loop");
+
+struct PhaseSpan {
+    double seconds = 0.0;
+    double startRate = 0.0;             // uL/min
+    double endRate = 0.0;
+};
+
+struct PhaseProgram {
+    QVector<PumpPhase> phases;
+    int lastPhase = 0;                  // highest phase number used
+    int merged = 0;                     // spans folded into the one before
+};
+
+PhaseProgram compilePumpPhases(int firstPhase, const QVector<PhaseSpan> &spans, bool stopAtEnd);
+
+#endif // PHASECOMPILER_H
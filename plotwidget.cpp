@@ -2,12 +2,15 @@
 #include "theming.h"
 
 PlotWidget::PlotWidget(QWidget *parent)
-    : QWidget(parent), _x(-100), yBot(0), yTop(100), runStart(0) {
+    : QWidget(parent), _x(-100), yBot(0), yTop(100), runStart(0), replotTimer(new QTimer(this)) {
+
+    replotTimer->setSingleShot(true);
+    connect(replotTimer, &QTimer::timeout, this, &PlotWidget::render);
 
     // Initialize the plot
     plot = new QCustomPlot(this);
     graph = plot->addGraph();
-    graph->setLineStyle(QCPGraph::lsStepCenter);
+    graph->setLineStyle(lineStyle);
 
     QPen pen;
     pen.setWidth(2);
@@ -20,6 +23,32 @@ PlotWidget::PlotWidget(QWidget *parent)
     plot->xAxis->setTickLabelFont(QFont("Arial", 12));
     plot->yAxis->setTickLabelFont(QFont("Arial", 12));
 
+    // Run cursor, created once and moved in place. Its layer sits between the
+    // graph and the axes and has its own paint buffer.
+    plot->addLayer("cursor", plot->layer("main"), QCustomPlot::limAbove);
+    cursorLayer = plot->layer("cursor");
+    cursorLayer->setMode(QCPLayer::lmBuffered);
+    cursor = new QCPItemLine(plot);
+    cursor->setLayer(cursorLayer);
+    cursor->setClipToAxisRect(true);
+    QPen cursorPen;
+    cursorPen.setWidth(2);
+    cursorPen.setColor(UiGreen);
+    cursor->setPen(cursorPen);
+    cursor->setVisible(false);
+
+    // Horizontal zoom/pan for looking back over long runs
+    plot->setInteractions(QCP::iRangeDrag | QCP::iRangeZoom);
+    plot->axisRect()->setRangeDrag(Qt::Horizontal);
+    plot->axisRect()->setRangeZoom(Qt::Horizontal);
+    connect(plot->xAxis, QOverload<const QCPRange &>::of(&QCPAxis::rangeChanged), this, &PlotWidget::onRangeChanged);
+    connect(plot, &QCustomPlot::mousePress, this, [this]() { followData = false; });
+    connect(plot, &QCustomPlot::mouseWheel, this, [this]() { followData = false; });
+    connect(plot, &QCustomPlot::mouseDoubleClick, this, [this]() {
+        followData = true;
+        onChange();
+    });
+
 
     // Set layout
     QVBoxLayout *layout = new QVBoxLayout();
@@ -32,7 +61,9 @@ PlotWidget::PlotWidget(QWidget *parent)
 
 void PlotWidget::setX(double currX) {
     _x = currX;
-    onChange();
+    placeCursor((yTop - yBot) * 0.05);
+    cursorDirty = true;
+    scheduleFrame();
 }
 
 double PlotWidget::x() const {
@@ -50,13 +81,21 @@ void PlotWidget::setYlabel(QString label){
     plot->yAxis->setLabel(label);
 }
 
+void PlotWidget::setLineStyle(QCPGraph::LineStyle style) {
+    lineStyle = style;
+    graph->setLineStyle(style);
+    onChange();
+}
+
 void PlotWidget::clearAxes() {
+    series.clear();
     plot->clearGraphs();
     graph = plot->addGraph();
+    graph->setLineStyle(lineStyle);
     graph->setPen(QPen(QColor(222,101, 94)));
     plot->xAxis->setLabel("");
     plot->yAxis->setLabel("");
-    plot->replot();
+    onChange();
 }
 
 void PlotWidget::setStart(double time) {
@@ -71,47 +110,158 @@ void PlotWidget::setStop() {
     runStart = 0;
 }
 
-void PlotWidget::setData(QVector<double> xVals, QVector<double> yVals) {
+double PlotWidget::nudgeX(double x, double lastX) const {
     // I was getting weird jagged lines when two consecutive X vals were the same
     // This inserts some fuzzy values into X so they aren't the same
+    if (x <= lastX) {
+        // Add a small random epsilon between 0 and 0.001
+        double epsilon = QRandomGenerator::global()->bounded(0.001);
+        x = lastX + epsilon;
+    }
+    return x;
+}
+
+void PlotWidget::setData(QVector<double> xVals, QVector<double> yVals) {
     QVector<double> adjustedX;
     adjustedX.reserve(xVals.size());
 
     double lastX = -std::numeric_limits<double>::infinity();
 
     for (double x : xVals) {
-        if (x <= lastX) {
-            // Add a small random epsilon between 0 and 0.001
-            double epsilon = QRandomGenerator::global()->bounded(0.001);
-            x = lastX + epsilon;
-        }
+        x = nudgeX(x, lastX);
         adjustedX.append(x);
         lastX = x;
     }
 
-    xData = adjustedX;
-    yData = yVals;
+    int count = static_cast<int>(std::min(adjustedX.size(), yVals.size()));
+    series.set(adjustedX.constData(), yVals.constData(), count);
     onChange();
 }
 
 
 QVector<QVector<double>> PlotWidget::getData()
 {
+    // Full resolution, not what's on screen
+    const std::vector<double> &xs = series.rawX();
+    const std::vector<double> &ys = series.rawY();
+    const int first = static_cast<int>(xs.size()) - series.size();
     QVector<QVector<double>> result;
-    result.append(xData);
-    result.append(yData);
+    result.append(QVector<double>(xs.begin() + first, xs.end()));
+    result.append(QVector<double>(ys.begin() + first, ys.end()));
     return result;
 }
 
 void PlotWidget::appendData(double x, double y) {
-    xData.append(x);
-    yData.append(y);
+    if (!series.isEmpty()) {
+        x = nudgeX(x, series.lastX());
+    }
+    series.append(x, y);
     onChange();
 }
 
+void PlotWidget::trimBefore(double x) {
+    series.trimBefore(x);
+}
+
+void PlotWidget::shiftX(double dx) {
+    series.shiftX(dx);
+    onChange();
+}
+
+void PlotWidget::clearData() {
+    series.clear();
+    onChange();
+}
+
+void PlotWidget::refreshView() {
+    // Only the visible range goes to QCustomPlot, at roughly one bucket per pixel
+    const QCPRange range = plot->xAxis->range();
+    const int pixels = std::max(200, plot->axisRect()->width());
+    series.extract(range.lower, range.upper, 2 * pixels, viewKeys, viewValues);
+
+    QVector<QCPGraphData> view;
+    view.reserve(static_cast<int>(viewKeys.size()));
+    for (size_t i = 0; i < viewKeys.size(); ++i) {
+        view.append(QCPGraphData(viewKeys[i], viewValues[i]));
+    }
+    graph->data()->set(view, true);
+}
+
+void PlotWidget::onRangeChanged() {
+    // User zoom/drag; onChange refreshes the view itself
+    if (!settingRange) {
+        refreshView();
+    }
+}
+
 void PlotWidget::onChange() {
-    plot->clearItems();
-    graph->setData(xData, yData);
+    ++stats.requested;
+    dirty = true;
+    scheduleFrame();
+}
+
+void PlotWidget::scheduleFrame() {
+    if (replotTimer->isActive()) {
+        ++stats.coalesced;
+        return;
+    }
+    // Next frame, but never sooner than 1/maxFps after the last replot
+    const int frameMs = 1000 / maxFps;
+    int wait = 0;
+    if (sinceReplot.isValid()) {
+        wait = std::max<qint64>(0, frameMs - sinceReplot.elapsed());
+    }
+    replotTimer->start(wait);
+}
+
+ReplotStats PlotWidget::replotStats() const {
+    return stats;
+}
+
+bool PlotWidget::canDraw() const {
+    return isVisible() && !window()->isMinimized();
+}
+
+void PlotWidget::showEvent(QShowEvent *event) {
+    QWidget::showEvent(event);
+    // Minimize/restore only reaches the top-level window, so listen there
+    if (watchedWindow != window()) {
+        if (watchedWindow) {
+            watchedWindow->removeEventFilter(this);
+        }
+        watchedWindow = window();
+        watchedWindow->installEventFilter(this);
+    }
+    if (dirty || cursorDirty) {
+        scheduleFrame();
+    }
+}
+
+bool PlotWidget::eventFilter(QObject *watched, QEvent *event) {
+    if (watched == watchedWindow && event->type() == QEvent::WindowStateChange && (dirty || cursorDirty) && canDraw()) {
+        scheduleFrame();
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
+void PlotWidget::render() {
+    if (!canDraw()) {
+        // Stays dirty; showEvent/restore picks it up
+        ++stats.skippedHidden;
+        return;
+    }
+    sinceReplot.start();
+    if (!dirty) {
+        // Only the cursor moved
+        cursorDirty = false;
+        ++stats.cursorOnly;
+        cursorLayer->replot();
+        return;
+    }
+    dirty = false;
+    cursorDirty = false;
+    ++stats.performed;
+
     //qDebug() << "Updating data for plot; min/maxY is " << yBot << yTop;
 
 
@@ -128,10 +278,9 @@ void PlotWidget::onChange() {
     //    }
     //}
 
-    if (!xData.isEmpty()) {
-        auto xMinMax = std::minmax_element(xData.constBegin(), xData.constEnd());
-        xMin = *xMinMax.first;
-        xMax = *xMinMax.second;
+    if (!series.isEmpty()) {
+        xMin = series.firstX();
+        xMax = series.lastX();
     }
 
 
@@ -139,21 +288,21 @@ void PlotWidget::onChange() {
     double xPadding = (xMax - xMin) * 0.05;
     double yPadding = (yMax - yMin) * 0.05;
 
-    plot->xAxis->setRange(xMin - xPadding, xMax + xPadding);
-    plot->yAxis->setRange(yMin - yPadding, yMax + yPadding);
-
-    // Draw vertical line if needed
-
-    if (_x >= 0) {
-        QCPItemLine *vLine = new QCPItemLine(plot);
-        QPen m_pen;
-        m_pen.setWidth(2);
-        m_pen.setColor(UiGreen);
-        vLine->setPen(m_pen);
-        vLine->start->setCoords(_x, yBot - yPadding);
-        vLine->end->setCoords(_x, yTop + yPadding);
-
+    settingRange = true;
+    if (followData) {
+        plot->xAxis->setRange(xMin - xPadding, xMax + xPadding);
     }
+    plot->yAxis->setRange(yMin - yPadding, yMax + yPadding);
+    settingRange = false;
+    refreshView();
+    placeCursor(yPadding);
 
     plot->replot();
 }
+
+void PlotWidget::placeCursor(double yPadding) {
+    // Vertical line at _x, hidden while there's no run
+    cursor->setVisible(_x >= 0);
+    cursor->start->setCoords(_x, yBot - yPadding);
+    cursor->end->setCoords(_x, yTop + yPadding);
+}
@@ -2,9 +2,32 @@
 #define PLOTWIDGET_H
 
 #include <QWidget>
+#include <QElapsedTimer>
+#include <QTimer>
 #include <QVBoxLayout>
 #include <QVector>
 #include "libs/qcustomplot/qcustomplot.h"
+#include "lodseries.h"
+
+// Every series keeps its full data in a LodSeries and the QCPGraph only ever
+// holds what's on screen, decimated to about one min/max pair per pixel.
+// Dragging or wheeling the x axis zooms/pans (and stops following new data);
+// double-click goes back to showing everything.
+//
+// Nothing replots straight away: onChange() marks the plot dirty and a single
+// replot happens at the next frame, at most maxFps times a second, so a burst
+// of setX/setData/appendData calls draws once. While the plot is hidden or the
+// window is minimized it doesn't draw at all, and catches up when shown.
+// The run cursor lives on its own buffered layer, so moving it with setX only
+// repaints that layer and not the curve underneath.
+
+struct ReplotStats {
+    qint64 requested = 0;       // onChange() calls
+    qint64 performed = 0;       // actual replots
+    qint64 cursorOnly = 0;      // frames where only the cursor layer was repainted
+    qint64 coalesced = 0;       // folded into a replot that was already scheduled
+    qint64 skippedHidden = 0;   // frames not drawn because nobody could see them
+};
 
 class PlotWidget : public QWidget {
     Q_OBJECT
@@ -18,6 +41,7 @@ public:
     void setYAxis(int pac, int pbc);
 
     void setYlabel(QString label);
+    void setLineStyle(QCPGraph::LineStyle style);   // readings are steps, protocols are lines
 
     void clearAxes();
 
@@ -26,8 +50,20 @@ public:
     void setStop();
     void setData(QVector<double> xVals, QVector<double> yVals);
     QVector<QVector<double>> getData();
+
+    // Incremental updates. appendData is cheap for x at or after the last point;
+    // shiftX touches every point, so it's for one-off rebasing (e.g. when a run
+    // starts), not per sample.
     void appendData(double x, double y);
-    void onChange();
+    void trimBefore(double x);              // drops points with x <= the given one
+    void shiftX(double dx);
+    void clearData();
+    void onChange();                        // schedules a replot
+    ReplotStats replotStats() const;
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private:
     QCustomPlot *plot;
@@ -35,7 +71,29 @@ private:
     double _x;
     int yBot, yTop;
     double runStart;
-    QVector<double> xData, yData;
+    LodSeries series;
+    std::vector<double> viewKeys, viewValues;
+    QCPGraph::LineStyle lineStyle = QCPGraph::lsStepCenter;
+    bool followData = true;         // x range tracks the data until the user zooms/drags
+    bool settingRange = false;
+
+    static constexpr int maxFps = 30;
+    QTimer *replotTimer;
+    QElapsedTimer sinceReplot;
+    bool dirty = false;
+    bool cursorDirty = false;
+    QCPLayer *cursorLayer;
+    QCPItemLine *cursor;
+    QObject *watchedWindow = nullptr;
+    ReplotStats stats;
+
+    double nudgeX(double x, double lastX) const;
+    bool canDraw() const;
+    void scheduleFrame();
+    void placeCursor(double yPadding);
+    void render();
+    void refreshView();
+    void onRangeChanged();
 };
 
 #endif // PLOTWIDGET_H
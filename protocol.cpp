@@ -1,5 +1,6 @@
 #include "protocol.h"
 
+#include <algorithm>
 
 Protocol::Protocol(QObject* parent)
     : QObject(parent), timeStep(1) {
@@ -7,8 +8,8 @@ Protocol::Protocol(QObject* parent)
 }
 
 void Protocol::setDt(double dt) {
+    // The breakpoints don't depend on it
     timeStep = dt;
-    generate(segments);
 }
 
 double Protocol::dt() const {
@@ -16,20 +17,39 @@ double Protocol::dt() const {
     return timeStep;
 }
 
-const QVector<double>& Protocol::xvals() const {
-    return xValues;
+const QVector<double>& Protocol::times() const {
+    return breakTimes;
 }
 
-void Protocol::setXvals(const QVector<double>& x) {
-    xValues = x;
+const QVector<double>& Protocol::values() const {
+    return breakValues;
 }
 
-const QVector<double>& Protocol::yvals() const {
-    return yValues;
+double Protocol::duration() const {
+    return breakTimes.isEmpty() ? 0.0 : breakTimes.last();
 }
 
-void Protocol::setYvals(const QVector<double>& y) {
-    yValues = y;
+double Protocol::valueAt(double t) const {
+    if (breakTimes.isEmpty()) {
+        return 0.0;
+    }
+    if (t <= breakTimes.first()) {
+        return breakValues.first();
+    }
+    if (t >= breakTimes.last()) {
+        return breakValues.last();
+    }
+    // First breakpoint after t; at a step this lands in the later segment
+    auto it = std::upper_bound(breakTimes.constBegin(), breakTimes.constEnd(), t);
+    int i = static_cast<int>(it - breakTimes.constBegin());
+    double t0 = breakTimes[i - 1];
+    double t1 = breakTimes[i];
+    double y0 = breakValues[i - 1];
+    double y1 = breakValues[i];
+    if (t1 <= t0) {
+        return y1;
+    }
+    return y0 + (t - t0) / (t1 - t0) * (y1 - y0);
 }
 
 const QVector<QVector<double>> Protocol::shareSegments()
@@ -40,8 +60,10 @@ const QVector<QVector<double>> Protocol::shareSegments()
 void Protocol::generate(const QVector<QVector<double>>& segs) {
     if (!segs.isEmpty()) {
         segments = segs;
-        QVector<double> xtot;
-        QVector<double> ytot;
+        breakTimes.clear();
+        breakValues.clear();
+        breakTimes.reserve(2 * segs.size());
+        breakValues.reserve(2 * segs.size());
         double totalTime = 0.0;
 
         for (const auto& seg : segs) {
@@ -51,34 +73,18 @@ void Protocol::generate(const QVector<QVector<double>>& segs) {
             double start = seg[1];
             double end = seg[2];
 
-            QVector<double> x = { totalTime, totalTime + duration };
-            QVector<double> y = { start, end };
-
-            int steps = static_cast<int>((duration * 60.0) / timeStep);
-            QVector<double> xExpanded(steps + 1);
-            for (int i = 0; i <= steps; ++i) {
-                xExpanded[i] = x[0] + i * (x[1] - x[0]) / steps;
-            }
-
-            QVector<double> yExpanded(steps + 1);
-            for (int i = 0; i <= steps; ++i) {
-                double t = xExpanded[i];
-                yExpanded[i] = start + ((t - x[0]) / (x[1] - x[0])) * (end - start);
-            }
-
-            xtot.append(xExpanded);
-            ytot.append(yExpanded);
+            breakTimes.append(totalTime);
+            breakValues.append(start);
+            breakTimes.append(totalTime + duration);
+            breakValues.append(end);
 
             totalTime += duration;
         }
-
-        xValues = xtot;
-        yValues = ytot;
     }
 }
 
 void Protocol::clear() {
-    xValues.clear();
-    yValues.clear();
+    breakTimes.clear();
+    breakValues.clear();
     segments.clear();
 }
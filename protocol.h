@@ -2,6 +2,16 @@
 #define PROTOCOL_H
 
 #include <QObject>
+#include <QVector>
+
+// The protocol as piecewise-linear breakpoints: each segment [duration, start,
+// end] adds its two ends, so a step between segments is two breakpoints at the
+// same time. Nothing is expanded per time step, valueAt() is a binary search,
+// and the plot draws the breakpoints as straight lines.
+//
+// Example usage:
+//  protocol->generate(tableModel->getSegments());
+//  double conc = protocol->valueAt(elapsedMinutes);
 
 class Protocol : public QObject {
     Q_OBJECT
@@ -12,11 +22,11 @@ public:
     void setDt(double dt);
     double dt() const;
 
-    const QVector<double>& xvals() const;
-    void setXvals(const QVector<double>& x);
-
-    const QVector<double>& yvals() const;
-    void setYvals(const QVector<double>& y);
+    // Breakpoints, times in minutes
+    const QVector<double>& times() const;
+    const QVector<double>& values() const;
+    double duration() const;                // minutes
+    double valueAt(double t) const;         // clamped to the ends
 
     void generate(const QVector<QVector<double>>& segs);
     void clear();
@@ -24,8 +34,8 @@ public:
 
 private:
     double timeStep;
-    QVector<double> xValues;
-    QVector<double> yValues;
+    QVector<double> breakTimes;
+    QVector<double> breakValues;
     QVector<QVector<double>> segments;
 };
 
@@ -0,0 +1,189 @@
+#include "protocolfile.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+namespace {
+
+constexpr int fileVersion = 1;
+// Bump whenever phase generation changes, so stale programs are never reused
+constexpr int compilerVersion = 1;
+
+QJsonObject phaseToJson(const PumpPhase &phase) {
+    QJsonObject object;
+    object["phase"] = phase.phaseNumber;
+    object["function"] = phase.function;
+    object["rate"] = phase.rate;
+    object["volume"] = phase.volume;
+    object["time"] = phase.time;
+    object["direction"] = phase.direction;
+    return object;
+}
+
+PumpPhase phaseFromJson(const QJsonObject &object) {
+    PumpPhase phase;
+    phase.phaseNumber = object["phase"].toInt();
+    phase.function = object["function"].toString();
+    phase.rate = object["rate"].toDouble();
+    phase.volume = object["volume"].toDouble();
+    phase.time = object["time"].toString();
+    phase.direction = object["direction"].toString("INF");
+    return phase;
+}
+
+bool writeJson(const QString &path, const QJsonObject &object, QString *error) {
+    // QSaveFile so a crash mid-write never leaves half a file behind
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    file.write(QJsonDocument(object).toJson(QJsonDocument::Indented));
+    if (!file.commit()) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool readJson(const QString &path, QJsonObject *object, QString *error) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = file.errorString();
+        return false;
+    }
+    QJsonParseError parseError;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (!doc.isObject()) {
+        if (error) *error = parseError.error != QJsonParseError::NoError ? parseError.errorString() : "not a JSON object";
+        return false;
+    }
+    *object = doc.object();
+    return true;
+}
+
+} // namespace
+
+QByteArray ProtocolFile::cacheKey(int startPhase) const {
+    // Full precision text, so equal inputs always hash the same
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    auto add = [&hash](double value) {
+        hash.addData(QByteArray::number(value, 'g', 17));
+        hash.addData(QByteArrayView(";"));
+    };
+    add(compilerVersion);
+    add(startPhase);
+    add(pac);
+    add(pbc);
+    add(flowRate);
+    for (const auto &seg : segments) {
+        for (double value : seg) {
+            add(value);
+        }
+        hash.addData(QByteArrayView("|"));
+    }
+    return hash.result().toHex();
+}
+
+bool saveProtocolFile(const QString &path, const ProtocolFile &protocol, QString *error) {
+    QJsonArray segments;
+    for (const auto &seg : protocol.segments) {
+        QJsonArray row;
+        for (double value : seg) {
+            row.append(value);
+        }
+        segments.append(row);
+    }
+    QJsonObject object;
+    object["version"] = fileVersion;
+    object["pac"] = protocol.pac;
+    object["pbc"] = protocol.pbc;
+    object["flowRate"] = protocol.flowRate;
+    object["segments"] = segments;
+    return writeJson(path, object, error);
+}
+
+bool loadProtocolFile(const QString &path, ProtocolFile *protocol, QString *error) {
+    QJsonObject object;
+    if (!readJson(path, &object, error)) {
+        return false;
+    }
+    if (object["version"].toInt() != fileVersion) {
+        if (error) *error = QString("unsupported protocol file version %1").arg(object["version"].toInt());
+        return false;
+    }
+    ProtocolFile loaded;
+    loaded.pac = object["pac"].toInt(loaded.pac);
+    loaded.pbc = object["pbc"].toInt(loaded.pbc);
+    loaded.flowRate = object["flowRate"].toDouble(loaded.flowRate);
+    const QJsonArray segments = object["segments"].toArray();
+    loaded.segments.reserve(segments.size());
+    for (const QJsonValue &value : segments) {
+        const QJsonArray row = value.toArray();
+        if (row.size() != 3) {
+            if (error) *error = "every segment needs [duration, start, end]";
+            return false;
+        }
+        loaded.segments.append({ row[0].toDouble(), row[1].toDouble(), row[2].toDouble() });
+    }
+    *protocol = loaded;
+    return true;
+}
+
+QString PhaseCache::directory() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/phases";
+}
+
+bool PhaseCache::lookup(const QByteArray &key, QVector<QVector<PumpPhase>> *phases) {
+    auto known = memory.constFind(key);
+    if (known != memory.constEnd()) {
+        *phases = known.value();
+        return true;
+    }
+
+    QJsonObject object;
+    if (!readJson(QDir(directory()).filePath(QString::fromLatin1(key) + ".json"), &object, nullptr)) {
+        return false;
+    }
+    QVector<QVector<PumpPhase>> loaded;
+    for (const QJsonValue &pump : object["pumps"].toArray()) {
+        QVector<PumpPhase> program;
+        for (const QJsonValue &phase : pump.toArray()) {
+            program.append(phaseFromJson(phase.toObject()));
+        }
+        loaded.append(program);
+    }
+    if (loaded.isEmpty()) {
+        return false;
+    }
+    memory.insert(key, loaded);
+    *phases = loaded;
+    return true;
+}
+
+void PhaseCache::store(const QByteArray &key, const QVector<QVector<PumpPhase>> &phases) {
+    memory.insert(key, phases);
+
+    // The disk copy is only an optimisation, so failures are ignored
+    QDir dir(directory());
+    if (!dir.mkpath(".")) {
+        return;
+    }
+    QJsonArray pumps;
+    for (const auto &program : phases) {
+        QJsonArray list;
+        for (const PumpPhase &phase : program) {
+            list.append(phaseToJson(phase));
+        }
+        pumps.append(list);
+    }
+    QJsonObject object;
+    object["pumps"] = pumps;
+    writeJson(dir.filePath(QString::fromLatin1(key) + ".json"), object, nullptr);
+}
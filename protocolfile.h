@@ -0,0 +1,49 @@
+#ifndef PROTOCOLFILE_H
+#define PROTOCOLFILE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#include "pumpcommands.h"
+
+// Saved protocols: the segment table plus the pump settings the flow rates are
+// worked out from, as a small JSON file.
+//
+// The compiled phase programs are cached separately, keyed by a SHA-256 of
+// exactly what goes into generatePumpPhases (segments, PaC, PbC, flow rate,
+// start phase), in memory and under CacheLocation/phases. A protocol that has
+// been sent before skips phase generation, and the pumps' phase mirror then
+// skips re-sending anything they already hold.
+//
+// Example usage:
+//  ProtocolFile protocol;
+//  loadProtocolFile(path, &protocol, &error);
+//  QByteArray key = protocol.cacheKey(1);
+//  if (!phaseCache.lookup(key, &phases)) { ... generate, then phaseCache.store(key, phases) ... }
+
+struct ProtocolFile {
+    int pac = 0;                            // mM in pump A's syringe
+    int pbc = 125;                          // mM in pump B's syringe
+    double flowRate = 0.4;                  // total
+    QVector<QVector<double>> segments;      // [duration (min), start (mM), end (mM)]
+
+    QByteArray cacheKey(int startPhase) const;
+};
+
+bool saveProtocolFile(const QString &path, const ProtocolFile &protocol, QString *error);
+bool loadProtocolFile(const QString &path, ProtocolFile *protocol, QString *error);
+
+class PhaseCache {
+public:
+    bool lookup(const QByteArray &key, QVector<QVector<PumpPhase>> *phases);
+    void store(const QByteArray &key, const QVector<QVector<PumpPhase>> &phases);
+
+    static QString directory();
+
+private:
+    QHash<QByteArray, QVector<QVector<PumpPhase>>> memory;
+};
+
+#endif // PROTOCOLFILE_H
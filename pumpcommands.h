@@ -5,10 +5,11 @@
 
 struct PumpPhase {
     int phaseNumber = 1;            // The phase number sent via PHN command
-    QString function;               // "RAT", "LIN", "STP"
+    QString function;               // "RAT", "LIN", "PAUSE", "LOOP", "ENDLOOP", "STOP"
     double rate = 0.0;              // Flow rate in µL/min
-    double volume;                  // Optional — only used for "RAT"
-    QString time;                   // Optional — only used for "LIN". Hours:Minutes or Seconds:Tenths depending on phase number (n, n+1)
+    double volume = 0.0;            // Optional — only used for "RAT"
+    QString time;                   // Optional — "LIN": Hours:Minutes or Seconds:Tenths depending on phase number (n, n+1),
+                                    // "PAUSE": seconds, "ENDLOOP": repeat count
     QString direction = "INF";      // "INF" or "WDR", default is "INF"
 };
 
@@ -26,8 +27,9 @@ enum class PumpCommand {
     SetFlowDirection,
     SetRampTime,
     SetVolUnits,
-    SetPause
-
+    SetPause,
+    LoopStart,
+    LoopEnd
 };
 
 #endif // PUMPCOMMANDS_H
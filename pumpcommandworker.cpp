@@ -1,34 +1,484 @@
 #include "pumpcommandworker.h"
-#include "pumpinterface.h"
 #include <QDebug>
+#include <QDeadlineTimer>
+#include <QTimer>
+#include <cmath>
 
-PumpCommandWorker::PumpCommandWorker(PumpInterface* interface, QObject* parent)
-    : QObject(parent), pumpInterface(interface) {
-    connect(pumpInterface, &PumpInterface::dataReceived,
-            this, &PumpCommandWorker::onResponseReceived);
+PumpCommandWorker::PumpCommandWorker(QObject* parent)
+    : QObject(parent), framer(0x02, 0x03) {}
+
+void PumpCommandWorker::initialize() {
+    serial = new QSerialPort(this);
+    connect(serial, &QSerialPort::readyRead, this, &PumpCommandWorker::handleReadyRead);
+    connect(serial, &QSerialPort::errorOccurred, this, &PumpCommandWorker::handleError);
+
+    stopTimer = new QTimer(this);
+    stopTimer->setSingleShot(true);
+    connect(stopTimer, &QTimer::timeout, this, &PumpCommandWorker::onStopTimeout);
+}
+
+bool PumpCommandWorker::openPort(const QString& portName, qint32 baudRate) {
+    closePort();
+
+    serial->setPortName(portName);
+    serial->setBaudRate(baudRate);
+    serial->setDataBits(QSerialPort::Data8);
+    serial->setParity(QSerialPort::NoParity);
+    serial->setStopBits(QSerialPort::OneStop);
+    serial->setFlowControl(QSerialPort::NoFlowControl);
+
+    if (!serial->open(QIODevice::ReadWrite)) {
+        emit errorOccurred("Failed to open port: " + serial->errorString());
+        return false;
+    }
+
+    serial->setDataTerminalReady(true);
+    serial->setRequestToSend(true);
+    //qDebug() << "Port opened successfully:" << serial->portName();
+    return true;
+}
+
+void PumpCommandWorker::closePort() {
+    if (serial && serial->isOpen()) {
+        serial->close();
+    }
+    framer.clear();
+}
+
+void PumpCommandWorker::writeCommand(int address, PumpCommand cmd, double value) {
+    PumpPacket packet;
+    if (!encodePumpCommand(packet, address, cmd, value)) {
+        emit errorOccurred("Could not encode command for pump " + QString::number(address));
+        return;
+    }
+    //qDebug() << "Sending to pump" << address << ":" << QByteArray(packet.data, packet.size);
+    writePacket(packet);
+}
+
+void PumpCommandWorker::stopPumps(const QVector<int>& addresses) {
+    // Replies still owed from before: STPs of a stop already running, and
+    // every send of the command each pump was working on (or draining)
+    QMap<int, StopState> previous = stopping ? stopPending : QMap<int, StopState>();
+    QMap<int, int> owed;
+    for (int address : addresses) {
+        owed[address] = previous.value(address).owed
+                        + (channels.contains(address) ? channels[address].owed : 0);
+    }
+
+    // Flush first: nothing that was queued before the stop gets to go out after it
+    int flushed = 0;
+    for (auto it = channels.begin(); it != channels.end(); ++it) {
+        PumpChannel &ch = it.value();
+        flushed += ch.queue.size() + (ch.processing ? 1 : 0);
+        ch.queue.clear();
+        ch.processing = false;
+        ch.draining = false;
+        ch.owed = 0;
+        ch.timeoutTimer->stop();
+    }
+    if (flushed > 0) {
+        emit commandsFlushed(flushed);
+    }
+
+    if (!stopping) {
+        // Pressing stop again while one is running keeps the original start time
+        stopClock.start();
+        stopsSent = 0;
+    }
+    stopping = true;
+    stopPending.clear();
+    for (int address : addresses) {
+        StopState state;
+        state.owed = owed.value(address);
+        stopPending.insert(address, state);
+    }
+    sendStop(stopPending.keys());
+}
+
+void PumpCommandWorker::sendStop(const QList<int>& addresses) {
+    PumpPacket packet;
+    int timeout = minTimeoutMs;
+    for (int address : addresses) {
+        appendPumpBurst(packet, address, PumpCommand::Stop);
+        StopState &state = stopPending[address];
+        ++state.sent;
+        ++state.owed;
+        timeout = qMax(timeout, timeoutFor(channel(address)));
+    }
+    finishPumpBurst(packet);
+    ++stopsSent;
+    writePacket(packet);
+    stopTimer->start(timeout);
+}
+
+bool PumpCommandWorker::handleStopReply(const PumpStatus& status) {
+    // While stopping, every reply is either an answer to STP or a leftover from
+    // a flushed command; neither belongs to the normal queues
+    int address = status.address;
+    if (!stopPending.contains(address)) {
+        return true;
+    }
+
+    StopState &state = stopPending[address];
+    state.owed = qMax(0, state.owed - 1);
+    state.stopped = status.state == PumpState::Stopped;
+    if (state.owed > 0) {
+        // More replies on the way; only the last one says where the pump ended up
+        return true;
+    }
+
+    if (state.stopped) {
+        stopPending.remove(address);
+        if (stopPending.isEmpty()) {
+            finishStop(true);
+        }
+        return true;
+    }
+
+    // 'P' after the first STP, or a stale 'I'/'W' -- either way it needs another
+    if (state.sent < maxStopAttempts) {
+        sendStop({address});
+    }
+    return true;
+}
+
+void PumpCommandWorker::onStopTimeout() {
+    if (!stopping) {
+        return;
+    }
+
+    // Whatever hasn't answered by now isn't going to. A pump whose latest
+    // reply was 'S' has drained and counts as stopped; the rest get another STP.
+    QList<int> unanswered;
+    for (auto it = stopPending.begin(); it != stopPending.end(); ) {
+        if (it->stopped) {
+            it = stopPending.erase(it);
+            continue;
+        }
+        if (it->sent < maxStopAttempts) {
+            it->owed = 0;
+            unanswered.append(it.key());
+        }
+        ++it;
+    }
+    if (stopPending.isEmpty()) {
+        finishStop(true);
+        return;
+    }
+    if (!unanswered.isEmpty()) {
+        qWarning() << "Stop not confirmed yet, resending STP to" << unanswered;
+        sendStop(unanswered);
+        return;
+    }
+
+    QStringList names;
+    for (int address : stopPending.keys()) {
+        names.append(QString::number(address));
+    }
+    emit errorOccurred(QString("Pump %1 did not confirm stop after %2 ms!")
+                           .arg(names.join(", "))
+                           .arg(stopClock.elapsed()));
+    stopPending.clear();
+    finishStop(false);
+}
+
+void PumpCommandWorker::finishStop(bool confirmed) {
+    stopTimer->stop();
+    stopping = false;
+    if (confirmed) {
+        emit pumpsStopped(stopClock.nsecsElapsed() / 1e6, stopsSent);
+    }
+
+    // Anything queued during the stop can go now
+    for (auto it = channels.begin(); it != channels.end(); ++it) {
+        if (!it.value().processing) {
+            processNext(it.key());
+        }
+    }
+}
+
+bool PumpCommandWorker::writePacket(const PumpPacket& packet) {
+    if (!serial || !serial->isOpen()) {
+        emit errorOccurred("Serial port not open.");
+        return false;
+    }
+    qint64 bytesWritten = serial->write(packet.data, packet.size);
+    return bytesWritten == packet.size;
+}
+
+void PumpCommandWorker::handleReadyRead() {
+    // Read straight into the framer's ring and pull frames out as they complete
+    while (serial->bytesAvailable() > 0) {
+        int room = 0;
+        char *dst = framer.writePtr(&room);
+        qint64 n = serial->read(dst, room);
+        if (n <= 0)
+            break;
+        framer.commit(static_cast<int>(n));
+
+        FrameView frame;
+        while (framer.next(frame)) {
+            PumpStatus status;
+            parsePumpStatus(frame.data, frame.size, status);
+            QString readable = QString::fromLatin1(frame.data, frame.size);
+            //qDebug() << "Parsed response:" << readable;
+            onResponseReceived(status);
+            if (status.address >= 0) {
+                emit statusReceived(status);
+            }
+            emit dataReceived(readable);
+        }
+    }
+}
+
+void PumpCommandWorker::handleError(QSerialPort::SerialPortError error) {
+    if (error == QSerialPort::NoError)
+        return;
+    emit errorOccurred("Serial error: " + serial->errorString());
+}
+
+PumpChannel& PumpCommandWorker::channel(int address) {
+    // Channels are created from enqueueCommand, so the timer lives in the worker thread
+    PumpChannel &ch = channels[address];
+    if (!ch.timeoutTimer) {
+        ch.timeoutTimer = new QTimer(this);
+        ch.timeoutTimer->setSingleShot(true);
+        connect(ch.timeoutTimer, &QTimer::timeout, this, [this, address]() {
+            onTimeout(address);
+        });
+    }
+    return ch;
 }
 
 void PumpCommandWorker::enqueueCommand(const AddressedCommand& command) {
-    commandQueue.enqueue(command);
-    if (!processing) {
-        processNext();
+    PumpChannel &ch = channel(command.address);
+    ch.queue.enqueue(command);
+    if (!ch.processing) {
+        processNext(command.address);
     }
 }
 
-void PumpCommandWorker::processNext() {
-    if (commandQueue.isEmpty()) {
-        // emit message that queue is complete?
-        processing = false;
+void PumpCommandWorker::enqueueBurst(const QVector<AddressedCommand>& commands) {
+    // Queue every member first so the burst can't be dispatched half-built
+    for (const AddressedCommand &command : commands) {
+        channel(command.address).queue.enqueue(command);
+    }
+    for (const AddressedCommand &command : commands) {
+        if (!channel(command.address).processing) {
+            processNext(command.address);
+        }
+    }
+}
+
+void PumpCommandWorker::processNext(int address) {
+    if (stopping) {
+        // Held until the stop is confirmed
+        return;
+    }
+    PumpChannel &ch = channel(address);
+    if (ch.draining) {
+        return;     // picked up again once the extra replies are in
+    }
+    if (ch.queue.isEmpty()) {
+        ch.processing = false;
+        if (idle()) {
+            emit queueEmpty();
+        }
+        return;
+    }
+
+    const AddressedCommand &head = ch.queue.head();
+    if (head.burst != 0) {
+        // Either everyone in the burst is ready and it goes now, or this pump
+        // waits for the others to catch up
+        ch.processing = false;
+        dispatchBurst(head.burst, head.burstSize);
+        return;
+    }
+
+    ch.current = ch.queue.dequeue();
+    ch.attempts = 0;
+    ch.owed = 0;
+    ch.processing = true;
+    send(address);
+}
+
+bool PumpCommandWorker::dispatchBurst(int burst, int burstSize) {
+    QVector<int> ready;
+    for (auto it = channels.constBegin(); it != channels.constEnd(); ++it) {
+        const PumpChannel &ch = it.value();
+        if (!ch.processing && !ch.draining && !ch.queue.isEmpty() && ch.queue.head().burst == burst) {
+            ready.append(it.key());
+        }
+    }
+    if (ready.size() < burstSize) {
+        return false;
+    }
+
+    PumpPacket packet;
+    for (int address : ready) {
+        PumpChannel &ch = channel(address);
+        ch.current = ch.queue.dequeue();
+        ch.attempts = 0;
+        ch.owed = 0;
+        ch.processing = true;
+        arm(address);
+        appendPumpBurst(packet, ch.current.address, ch.current.cmd, ch.current.value);
+    }
+    finishPumpBurst(packet);
+    writePacket(packet);
+    return true;
+}
+
+void PumpCommandWorker::arm(int address) {
+    PumpChannel &ch = channel(address);
+    ++ch.attempts;
+    ++ch.owed;
+    // Back off on resends in case the pump is just slow right now
+    ch.timeoutTimer->start(timeoutFor(ch) << (ch.attempts - 1));
+    ch.sent.start();
+}
+
+void PumpCommandWorker::send(int address) {
+    // Resends of burst members go out on their own
+    arm(address);
+    PumpChannel &ch = channel(address);
+    writeCommand(ch.current.address, ch.current.cmd, ch.current.value);
+}
+
+void PumpCommandWorker::onTimeout(int address) {
+    PumpChannel &ch = channel(address);
+    if (ch.draining) {
+        // The extra replies aren't coming; nothing left to mistake for the next answer
+        ch.draining = false;
+        ch.owed = 0;
+        processNext(address);
+        return;
+    }
+    if (!ch.processing) {
+        return;
+    }
+
+    if (ch.attempts <= maxRetries) {
+        qWarning() << "Pump" << address << "command timed out, resending (attempt" << ch.attempts + 1 << ")";
+        send(address);
+        return;
+    }
+
+    emit commandFailed(ch.current, ch.attempts, PumpError::None);
+    ch.processing = false;
+    finishCommand(address);
+}
+
+void PumpCommandWorker::finishCommand(int address) {
+    PumpChannel &ch = channel(address);
+    if (ch.owed > 0) {
+        // Resent commands may still have replies on the way; let them land
+        // before the next command goes out
+        ch.draining = true;
+        ch.timeoutTimer->start(timeoutFor(ch));
+        return;
+    }
+    processNext(address);
+}
+
+void PumpCommandWorker::onResponseReceived(const PumpStatus& status) {
+    if (stopping && handleStopReply(status)) {
         return;
     }
 
-    AddressedCommand cmd = commandQueue.dequeue();
-    emit pumpCommandReady(cmd.name, cmd.cmd, cmd.value);
-    processing = true;
+    int address = responseAddress(status);
+    if (address < 0) {
+        qWarning() << "PumpCommandWorker: can't tell which pump sent a reply";
+        return;
+    }
+
+    PumpChannel &ch = channel(address);
+    ch.owed = qMax(0, ch.owed - 1);
+    if (ch.draining) {
+        // An extra reply to the command just finished
+        if (ch.owed == 0) {
+            ch.timeoutTimer->stop();
+            ch.draining = false;
+            processNext(address);
+        }
+        return;
+    }
+    if (!ch.processing) {
+        // Late reply to a command we already gave up on
+        return;
+    }
+
+    if (status.error != PumpError::None && ch.owed > 0) {
+        // An older send's error while a newer one is still out; wait for that answer
+        return;
+    }
+    ch.timeoutTimer->stop();
+
+    // "?COM" means the pump got a garbled packet, so it's worth resending
+    if (status.error == PumpError::Communication && ch.attempts <= maxRetries) {
+        send(address);
+        return;
+    }
+
+    // Karn's rule: only time commands that went out once. A rejection is
+    // still a round trip, so it counts too.
+    if (ch.attempts == 1) {
+        updateRtt(ch, ch.sent.nsecsElapsed() / 1e6);
+        emit rttMeasured(address, ch.srtt);
+    }
+    ch.processing = false;
+    if (status.error != PumpError::None) {
+        // Rejected, or still garbled after every resend: the pump didn't take it
+        emit commandFailed(ch.current, ch.attempts, status.error);
+    } else {
+        // Same clock as utils::monotonicNs
+        emit commandCompleted(ch.current, QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs());
+    }
+    finishCommand(address);
+}
+
+void PumpCommandWorker::updateRtt(PumpChannel& ch, double rttMs) {
+    if (ch.srtt < 0) {
+        ch.srtt = rttMs;
+        ch.rttvar = rttMs / 2;
+    } else {
+        ch.rttvar = 0.75 * ch.rttvar + 0.25 * std::abs(ch.srtt - rttMs);
+        ch.srtt = 0.875 * ch.srtt + 0.125 * rttMs;
+    }
+}
+
+int PumpCommandWorker::timeoutFor(const PumpChannel& ch) const {
+    if (ch.srtt < 0) {
+        return initialTimeoutMs;
+    }
+    int timeout = static_cast<int>(ch.srtt + 4 * ch.rttvar);
+    return qBound(minTimeoutMs, timeout, maxTimeoutMs);
+}
+
+int PumpCommandWorker::responseAddress(const PumpStatus& status) const {
+    if (channels.contains(status.address)) {
+        return status.address;
+    }
+
+    // Garbled address: if only one pump is waiting, it has to be that one
+    int waiting = -1;
+    for (auto it = channels.constBegin(); it != channels.constEnd(); ++it) {
+        if (it.value().processing || it.value().draining) {
+            if (waiting >= 0) {
+                return -1;
+            }
+            waiting = it.key();
+        }
+    }
+    return waiting;
 }
 
-void PumpCommandWorker::onResponseReceived(const QString& response) {
-    Q_UNUSED(response)
-    processing = false;
-    processNext();
+bool PumpCommandWorker::idle() const {
+    for (const PumpChannel &ch : channels) {
+        if (ch.processing || ch.draining || !ch.queue.isEmpty()) {
+            return false;
+        }
+    }
+    return true;
 }
@@ -6,44 +6,152 @@
 
 #include <QObject>
 #include <QQueue>
+#include <QMap>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QSerialPort>
 
-// Forward declaration to avoid circular include
-class PumpInterface;
+class QTimer;
 
 #include "pumpcommands.h"  // Forward declaration or include depending on structure
+#include "pumpencoder.h"
+#include "pumpstatus.h"
+#include "serialframer.h"
 
 struct AddressedCommand {
     QString name;
+    int address = 0;
     PumpCommand cmd;
-    QString value;
+    double value = 0;
+    int burst = 0;          // non-zero: goes out in one packet with the rest of its burst
+    int burstSize = 1;
+    qint64 issuedNs = 0;    // caller's timestamp (utils::monotonicNs clock), handed back on completion
+    int upload = 0;         // non-zero: part of that setPhases upload
+    int phase = 0;          // phase number an upload command programs
 };
 
 // Queues the commands used by PumpInterface for sending to pump.
 // Needs testing to see if every command actually sends a response.
+//
+// The worker lives on its own thread and owns the QSerialPort: writing,
+// framing and matching replies to commands all happen here, so a busy GUI
+// thread (replots, console inserts, file dialogs) doesn't hold up the pumps.
+// PumpInterface only sees the parsed replies.
+//
+// Every packet is address-prefixed and every reply starts with the address,
+// so each pump gets its own queue: Pump A can be working on a command while
+// Pump B's reply is still coming back.
+//
+// Each in-flight command has a deadline. The timeout adapts to the round trip
+// times seen on that pump (srtt + 4*rttvar, like TCP's RTO) and a command that
+// times out is resent a bounded number of times before it's reported as failed
+// and the queue moves on. A late reply to the first send still answers the
+// command, but the resend's reply is owed too: the channel counts the replies
+// it's still owed and, before sending the next command, waits (one timeout at
+// most) for the extras and throws them away, so they can't be matched to the
+// command after. Only a clean reply completes a
+// command: "?OOR", "?NA", "?" and "?IGN" fail it straight away, and "?COM" is
+// resent like a timeout and fails once the resends run out.
+//
+// A burst (one command for several pumps) waits until it's at the head of
+// every member's queue, then goes out as a single "0VER*1VER*\r" packet. Each
+// pump still answers on its own, so the replies, timeouts and resends are
+// tracked per address as usual.
+//
+// Stopping jumps the line: stopPumps() throws away everything queued or in
+// flight (so a half-sent upload can't restart anything), sends STP, and keeps
+// sending STP to each pump until its prompt reads 'S'. A running pump answers
+// the first STP with 'P' (paused) and only stops on the second. Replies are
+// counted per pump, so a stale answer to a flushed command can't pass for the
+// STP's: a pump only counts as stopped once it has answered everything it
+// still owes and the last answer reads 'S'. New commands queued meanwhile wait
+// until every pump has confirmed or the stop gave up.
+
+struct PumpChannel {
+    QQueue<AddressedCommand> queue;
+    bool processing = false;
 
+    AddressedCommand current;
+    int attempts = 0;
+    int owed = 0;                   // replies still to come for current: one per send
+    bool draining = false;          // current is done, waiting out the rest of owed
+    QElapsedTimer sent;
+    QTimer *timeoutTimer = nullptr;
+    double srtt = -1;               // smoothed round trip, ms (-1 until first sample)
+    double rttvar = 0;
+};
 
 class PumpCommandWorker : public QObject {
     Q_OBJECT
 
 public:
-    explicit PumpCommandWorker(PumpInterface* interface, QObject* parent = nullptr);
+    explicit PumpCommandWorker(QObject* parent = nullptr);
 
 signals:
-    void pumpCommandReady(const QString& name, PumpCommand cmd, QString value);
+    void dataReceived(const QString& data);
+    void statusReceived(const PumpStatus& status);     // every reply, decoded
+    void queueEmpty();
+    void commandCompleted(const AddressedCommand& command, qint64 repliedNs);   // answered, after any resends
+    void commandFailed(const AddressedCommand& command, int attempts, PumpError error);  // error None: never answered
+    void errorOccurred(const QString& message);
+    void commandsFlushed(int count);                    // dropped by a stop
+    void rttMeasured(int address, double srttMs);       // smoothed round trip after each timed reply
+    void pumpsStopped(double latencyMs, int stopsSent); // every pump answered 'S'
 
 
 public slots:
+    void initialize();  // creates the port once we're on the worker thread
+    bool openPort(const QString& portName, qint32 baudRate);
+    void closePort();
     void enqueueCommand(const AddressedCommand& command);
+    void enqueueBurst(const QVector<AddressedCommand>& commands);
+    void writeCommand(int address, PumpCommand cmd, double value);     // immediate, not tracked
+    void stopPumps(const QVector<int>& addresses);
 
 private slots:
-    void onResponseReceived(const QString& response);
+    void handleReadyRead();
+    void handleError(QSerialPort::SerialPortError error);
 
 private:
-    void processNext();
-
-    QQueue<AddressedCommand> commandQueue;
-    PumpInterface* pumpInterface;
-    bool processing = false;
+    static constexpr int maxRetries = 2;
+    static constexpr int initialTimeoutMs = 500;    // before any RTT has been measured
+    static constexpr int minTimeoutMs = 100;
+    static constexpr int maxTimeoutMs = 3000;       // same ceiling as CondWorker
+    static constexpr int maxStopAttempts = 5;
+
+    void onResponseReceived(const PumpStatus& status);
+    bool writePacket(const PumpPacket& packet);
+    PumpChannel& channel(int address);
+    void processNext(int address);
+    bool dispatchBurst(int burst, int burstSize);
+    void arm(int address);
+    void send(int address);
+    void onTimeout(int address);
+    void finishCommand(int address);
+    void updateRtt(PumpChannel& channel, double rttMs);
+    int timeoutFor(const PumpChannel& channel) const;
+    int responseAddress(const PumpStatus& status) const;
+    bool idle() const;
+    bool handleStopReply(const PumpStatus& status);
+    void sendStop(const QList<int>& addresses);
+    void onStopTimeout();
+    void finishStop(bool confirmed);
+
+    QMap<int, PumpChannel> channels;
+    QSerialPort* serial = nullptr;
+    SerialFramer framer;
+
+    // Emergency stop in progress
+    bool stopping = false;
+    struct StopState {
+        int sent = 0;               // STPs sent to this pump
+        int owed = 0;               // replies still to come: STPs plus a command flushed in flight
+        bool stopped = false;       // the latest reply read 'S'
+    };
+    QMap<int, StopState> stopPending;   // address -> progress, until it's confirmed stopped
+    int stopsSent = 0;
+    QElapsedTimer stopClock;
+    QTimer* stopTimer = nullptr;
 };
 
 #endif // PUMPCOMMANDWORKER_H
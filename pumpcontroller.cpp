@@ -4,7 +4,9 @@
 #include "pumpcontroller.h"
 #include "ui_pumpcontroller.h"
 #include "comsdialog.h"
+#include "phasecompiler.h"
 #include "theming.h"
+#include "utils.h"
 
 PumpController::PumpController(QWidget *parent)
     : QMainWindow(parent),
@@ -45,7 +47,10 @@ PumpController::PumpController(QWidget *parent)
     ui->tableSegments->setSelectionMode(QAbstractItemView::NoSelection);
     ui->tableSegments->setSelectionBehavior(QAbstractItemView::SelectRows);
     currProtocol = new Protocol(this);
+    condJournal = new RunJournal(this);
+    RunJournal::prune();
     condPreSaveWindow = currProtocol->dt() * 60; // seconds
+    condPreReadings.setCapacity(condPreSaveWindow);
 
     // Timer stuff
     runTimer = new QTimer(this);
@@ -88,6 +93,8 @@ PumpController::PumpController(QWidget *parent)
     ui->condPlot->setYlabel("mS/cm");
     ui->label_cond_units->setText("mS/cm");
     ui->condPlot->setYAxis(0,15); // just freakin hardcode it
+    // The protocol plot gets breakpoints, so join them with straight lines
+    ui->protocolPlot->setLineStyle(QCPGraph::lsLine);
 
     //if (ui->butSetCondMin) {
     //    ui->gridLayout_7->removeWidget(ui->butSetCondMin); // remove from layout
@@ -139,6 +146,9 @@ PumpController::PumpController(QWidget *parent)
     connect(ui->butStartProtocol, &QPushButton::clicked, this, &PumpController::startProtocol);
     connect(ui->butSendProtocol, &QPushButton::clicked, this, &PumpController::sendProtocol);
     connect(ui->butStopProtocol, &QPushButton::clicked, this, &PumpController::stopProtocol);
+    connect(ui->checkStreamRates, &QCheckBox::toggled, this, &PumpController::streamModeChanged);
+    connect(ui->butSaveProtocol, &QPushButton::clicked, this, &PumpController::saveProtocol);
+    connect(ui->butLoadProtocol, &QPushButton::clicked, this, &PumpController::loadProtocol);
 
     connect(runTimer, &QTimer::timeout, this, &PumpController::stopProtocol);
     connect(intervalTimer, &QTimer::timeout, this, &PumpController::timerTick);
@@ -170,6 +180,14 @@ PumpController::PumpController(QWidget *parent)
 
 PumpController::~PumpController()
 {
+    // Exported runs are in the user's CSV now; the rest wait for RunJournal::prune
+    QVector<JournalRun> exported;
+    for (const JournalRun &run : savedRuns) {
+        if (run.exported) {
+            exported.append(run);
+        }
+    }
+    RunJournal::remove(exported);
     delete ui;
 }
 
@@ -250,53 +268,22 @@ void PumpController::setCondFile()
 
     QString saveFile = QFileDialog::getSaveFileName(this, tr("Save Console Text"), defaultDir);
 
-    if (!saveFile.isEmpty()) {
-        QFileInfo fileInfo(saveFile);
-        experimentDirectory = fileInfo.absolutePath();  // Update for next time
+    if (saveFile.isEmpty()) {
+        return;     // cancelled; the journals stay as they are
     }
-    QFile csvFile(saveFile+".csv");
-    if (csvFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        QTextStream out(&csvFile);
-
-        // --- Write the header ---
-        for (auto it = savedRuns.constBegin(); it != savedRuns.constEnd(); ++it) {
-            out << "\"" << it.key().toString("HH:mm:ss") << "\",\"\"";
-            if (it != std::prev(savedRuns.constEnd())) {
-                out << ","; // Comma between column groups
-            }
-        }
-        out << "\n";
-
-        // --- Determine max row count across all entries ---
-        int maxLen = 0;
-        for (const auto& pair : savedRuns) {
-            maxLen = std::max(maxLen, std::max(int(pair.first.size()), int(pair.second.size())));
-        }
-
-        // --- Write data rows ---
-        for (int i = 0; i < maxLen; ++i) {
-            int col = 0;
-            for (const auto& pair : savedRuns) {
-                const QList<double>& xvals = pair.first;
-                const QList<double>& yvals = pair.second;
-
-                if (i < xvals.size())
-                    out << QString::number(xvals[i], 'f', 6);
-                out << ",";
-
-                if (i < yvals.size())
-                    out << QString::number(yvals[i], 'f', 6);
-
-                if (++col < savedRuns.size())
-                    out << ",";
-            }
-            out << "\n";
-        }
-
-        csvFile.close();
+    QFileInfo fileInfo(saveFile);
+    experimentDirectory = fileInfo.absolutePath();  // Update for next time
+
+    // Runs are already on disk, so this is just a streaming merge of the journal files
+    QString error;
+    if (!RunJournal::exportCsv(savedRuns.values(), saveFile+".csv", &error)) {
+        qWarning() << "Could not write" << saveFile+".csv:" << error;
+        writeToConsole("Could not write conductivity data: " + error, UiRed);
+        return;
     }
-     else {
-        qWarning() << "Could not open file for writing:" << saveFile+".txt";
+    // Only now is there another copy, so only now may the journals be deleted on exit
+    for (JournalRun &run : savedRuns) {
+        run.exported = true;
     }
     writeToConsole("Writing conductivity data to "+saveFile+".csv", UiYellow);
 
@@ -335,7 +322,7 @@ void PumpController::confirmSettings()
         ui->butStartPump->setEnabled(1);
         ui->butUpdatePump->setEnabled(1);
         ui->butStopPump->setEnabled(1);
-        ui->butSendProtocol->setEnabled(1);
+        ui->butSendProtocol->setEnabled(!ui->checkStreamRates->isChecked());
     }
     //
 
@@ -409,26 +396,38 @@ void PumpController::initiateCond()
     {
        //qDeb <<"Creating cond";
         condInterface = new CondInterface(this);
-        condInterface->connectToMeter(condComPort);
         connect(condInterface, &CondInterface::measurementReceived,
                 this, &PumpController::receiveCondMeasurement);
         connect(condInterface, &CondInterface::errorOccurred, this, &PumpController::receivePumpError);
+        connect(condInterface, &CondInterface::samplingChanged, this, &PumpController::receiveCondSampling);
+        connect(condInterface, &CondInterface::samplingStats, this, &PumpController::receiveCondStats);
+        if (condInterface->connectToMeter(condComPort)) {
+            // The worker paces GETMEAS itself, on the same dt grid as the protocol
+            condInterface->startSampling(currProtocol->dt() * 1000);
+        }
     }
 
 }
 
 void PumpController::receiveCondMeasurement(CondReading reading)
 {
-    //qDebug() << "Conductivity:" << reading.value << reading.units;
-    double mSReading = reading.value;
-    if (reading.units == "mS/cm")
+    //qDebug() << "Conductivity:" << reading.value << condUnitsName(reading.units);
+    double mSReading = condToMilliSiemens(reading.value, reading.units);
+    if (reading.units != CondUnits::Unknown)
     {
         ui->label_cond->setText(QString::number(mSReading, 'f', 2));
-    } else if (reading.units == "uS/cm")
-    {
-        //qDebug() << "in this if?";
-        mSReading = reading.value / 1000;
-        ui->label_cond->setText(QString::number(mSReading,'f',2));
+    }
+
+    // Placed on the time axis by when the meter was asked, not by how many came before it
+    CondSample sample{reading.requestedNs, mSReading};
+    condLatency.add(reading.latencyMs());
+    if (runTimer->isActive()) {
+        // A reply to a request made before the start lands here late. Its
+        // pre-run rows went into the journal when the run opened, so writing it
+        // now would put a negative time after them; leave it out of the run.
+        if (sample.t >= runStartNs) {
+            condJournal->append((sample.t - runStartNs) / 60e9, sample.value);
+        }
     }
 
     if (!runTimer->isActive())
@@ -436,47 +435,30 @@ void PumpController::receiveCondMeasurement(CondReading reading)
         // Save the previous 120 measurements (aka 1 minute).
 
         //qDebug() << "Run Timer Not Active";
-        if (condPreReadings.size() >= condPreSaveWindow) {
-            condPreReadings.pop_front();  // Remove oldest
-        }
-
-        condPreReadings.push_back(mSReading);  // Add newest
+        condPreReadings.push(sample);  // Add newest, the ring drops the oldest once full
         //qDebug() << QTime::currentTime() << ": added to previous readings";
-    } else {
-        condReadings.append(mSReading);
-        //qDebug() << QTime::currentTime() << ": collecting protocol readings";
     }
-    updateCondPlot();
+    updateCondPlot(sample);
 }
 
-void PumpController::updateCondPlot()
+void PumpController::updateCondPlot(const CondSample &sample)
 /* This function is called after a conductivity measurement is received.
- * It updates the conductivity plot using the stored measurements.
+ * It appends the new point to the conductivity plot; nothing already on the
+ * plot is touched, so this costs the same at minute one and hour ten.
  */
 {
-    // Update Y values.
-    int preX = 0-(condPreReadings.length() * currProtocol->dt());
-    QVector<double> condXvals = generateRangeScaled(preX, -1*currProtocol->dt());
-    QVector<double> condYvals = condPreReadings;
-    //qDebug() << "X,Y: " << condXvals.length() << condYvals.length() << " matches " << preX;
-    if (runTimer->isActive())
-    {
-        QVector<double> postXs = generateRangeScaled(0, (condReadings.length()-1)*currProtocol->dt());
-        condXvals.append(postXs);
-        condYvals.append(condReadings);
+    // X is minutes from condPlotOriginNs. Before a run that's just wherever the
+    // baseline started; when the run starts the plot is shifted once so the
+    // start is at 0 (see startProtocol).
+    if (condPlotOriginNs == 0) {
+        condPlotOriginNs = sample.t;
     }
-    //if (!condYvals.isEmpty()) {
-    //    auto [minIt, maxIt] = std::minmax_element(condYvals.constBegin(), condYvals.constEnd());
-    //   //qDeb << "MIN/MAX" << *minIt << *maxIt;
-    //    ui->condPlot->setYAxis(*minIt, *maxIt);
 
-    //}
-
-    if (condXvals.length() == condYvals.length())
-    {
-        ui->condPlot->setData(condXvals, condYvals);
+    if (!runTimer->isActive() && !condPreReadings.isEmpty()) {
+        // Baseline only shows what the ring still holds
+        ui->condPlot->trimBefore((condPreReadings.first().t - condPlotOriginNs) / 60e9 - 1e-9);
     }
-
+    ui->condPlot->appendData((sample.t - condPlotOriginNs) / 60e9, sample.value);
 }
 
 void PumpController::resetCondPlot()
@@ -490,6 +472,8 @@ void PumpController::initiatePumps()
 // For this, Pump A is address 0, Pump B is address 1
 // This is true in all cases.
 {
+    delete rateStreamer;
+    rateStreamer = nullptr;
     if (pumpInterface) {
         pumpInterface->shutdown();
         delete pumpInterface;
@@ -503,6 +487,15 @@ void PumpController::initiatePumps()
         pumpInterface->connectToPumps(pumpComPort);
         connect(pumpInterface, &PumpInterface::errorOccurred, this, &PumpController::receivePumpError);
         connect(pumpInterface, &PumpInterface::dataReceived, this, &PumpController::receivePumpResponse);
+        connect(pumpInterface, &PumpInterface::pumpsStopped, this, &PumpController::receivePumpsStopped);
+        connect(pumpInterface, &PumpInterface::statusChanged, this, &PumpController::receivePumpStatus);
+        connect(pumpInterface, &PumpInterface::uploadStarted, this, &PumpController::receiveUploadStarted);
+        connect(pumpInterface, &PumpInterface::uploadProgress, this, &PumpController::receiveUploadProgress);
+        connect(pumpInterface, &PumpInterface::uploadFinished, this, &PumpController::receiveUploadFinished);
+
+        rateStreamer = new RateStreamer(pumpInterface, this);
+        rateStreamer->setRampStep(currProtocol->dt() * 1000);
+        connect(rateStreamer, &RateStreamer::errorOccurred, this, &PumpController::receivePumpError);
 
     }
 }
@@ -527,6 +520,41 @@ void PumpController::receivePumpResponse(const QString& msg)
 
 }
 
+void PumpController::receivePumpStatus(const PumpStatus& status)
+{
+    // Raw replies already go to the console; only call out the ones that need attention
+    QString name = pumpInterface->pumpName(status.address);
+    if (status.alarm != PumpAlarm::None) {
+        writeToConsole(name + " ALARM: " + pumpAlarmName(status.alarm), UiRed);
+    } else if (status.error != PumpError::None && status.error != PumpError::Communication) {
+        writeToConsole(name + " rejected command: " + pumpErrorName(status.error), UiRed);
+    }
+}
+
+void PumpController::receiveCondSampling(int periodMs, double responseMs)
+{
+    QString msg = QString("Cond meter answers in %1 ms, sampling every %2 s")
+                      .arg(responseMs, 0, 'f', 0).arg(periodMs / 1000.0, 0, 'f', 1);
+    writeToConsole(msg, periodMs > currProtocol->dt() * 1000 ? UiYellow : UiGreen);
+}
+
+void PumpController::receiveCondStats(double effectiveHz, double responseMs, int skipped, int timeouts)
+{
+    condSampleRate = effectiveHz;
+    //qDebug() << "Cond sampling:" << effectiveHz << "Hz, response" << responseMs << "ms," << skipped << "skipped";
+    ui->label_cond->setToolTip(QString("%1 samples/s, meter answers in %2 ms, %3 skipped and %4 timed out in the last window")
+                                   .arg(effectiveHz, 0, 'f', 2)
+                                   .arg(responseMs, 0, 'f', 0)
+                                   .arg(skipped)
+                                   .arg(timeouts));
+}
+
+void PumpController::receivePumpsStopped(double latencyMs, int stopsSent)
+{
+    writeToConsole(QString("Pumps stopped (confirmed in %1 ms, %2 STP sent)")
+                       .arg(latencyMs, 0, 'f', 1).arg(stopsSent), UiGreen);
+}
+
 
 
 
@@ -585,8 +613,9 @@ void PumpController::updateProtocol()
 // Not a button, but called automatically whenever the protocol changes.
 {
     currProtocol->generate(tableModel->getSegments());
-    ui->protocolPlot->setData(currProtocol->xvals(),currProtocol->yvals());
-    ui->butStartProtocol->setDisabled(1);
+    ui->protocolPlot->setData(currProtocol->times(), currProtocol->values());
+    // Streaming needs no upload, otherwise the new program has to be sent first
+    ui->butStartProtocol->setEnabled(ui->checkStreamRates->isChecked() && !ui->butConfirmSettings->isEnabled());
 
 
 }
@@ -601,6 +630,13 @@ void PumpController::updatePumps()
     QVector<QVector<double>> run = { QVector<double>{0, conc, conc} };
    //qDebug() << run;
     QVector<QVector<PumpPhase>> phases = generatePumpPhases(0, run);
+    if (uploadingProtocol) {
+        // Takes over from a protocol upload still in progress; that one needs sending again
+        writeToConsole("Protocol upload interrupted, send it again before starting", UiYellow);
+        ui->butSendProtocol->setText("Send to Pump");
+        ui->butSendProtocol->setEnabled(!ui->checkStreamRates->isChecked());
+        uploadingProtocol = false;
+    }
     pumpInterface->setPhases(phases);
 }
 
@@ -630,17 +666,16 @@ void PumpController::startProtocol()
             double end = seg[2];
             writeToConsole(QString::number(duration, 'f', 2)+" min | "+QString::number(start)+" mM | " +QString::number(end)+" mM", UiBlue);
         }
-        // timepoints in seconds. subtract one because we care about time intervals
-        // (e.g. 15 seconds is 31 points, so subtract one to give 15 seconds.
-        // I subtract a second time point too because I skip the first point to sync
-        // with the interval timer.
-        double totalTime = (currProtocol->xvals().count() - 1)*currProtocol->dt()*1000; //
+        // run length in ms
+        double totalTime = currProtocol->duration() * 60 * 1000;
         //qDebug() << "Total Time: " << totalTime;
 
         // Use a lambda that captures `this`
         auto starter = new QObject(this); // use a temporary object for connection context
+        // Streaming sends rates live from the protocol clock instead of running the uploaded program
+        const bool streaming = ui->checkStreamRates->isChecked() && rateStreamer;
 
-        connect(intervalTimer, &QTimer::timeout, starter, [this, starter, totalTime]() {
+        connect(intervalTimer, &QTimer::timeout, starter, [this, starter, totalTime, streaming]() {
             // Disconnect this temporary connection
             disconnect(intervalTimer, nullptr, starter, nullptr);
             starter->deleteLater();
@@ -649,9 +684,19 @@ void PumpController::startProtocol()
 
             // Only the first interval might be shorter, the rest will be syncd with intTimer
             runTimer->start(totalTime);
+            runStartNs = utils::monotonicNs();
+            journalRunStart(runStartNs);
+            if (condPlotOriginNs != 0) {
+                // The one time the baseline moves: run start becomes x = 0
+                ui->condPlot->shiftX((condPlotOriginNs - runStartNs) / 60e9);
+            }
+            condPlotOriginNs = runStartNs;
+            if (streaming) {
+                rateStreamer->start(currProtocol, [this](double conc) { return calculateFlowRates(conc); }, runStartNs);
+            }
             //qDebug() << "Synchronized protocol start! runTimer remaining time now: " << runTimer->remainingTime();
             xPos = 0;
-            ui->protocolPlot->setX(currProtocol->xvals().at(xPos));
+            ui->protocolPlot->setX(xPos);
             writeToConsole("Protocol started.", UiGreen);
         });
         ui->butStopProtocol->setEnabled(1);
@@ -662,20 +707,22 @@ void PumpController::startProtocol()
         ui->butAddSegment->setDisabled(1);
         ui->butDeleteSegment->setDisabled(1);
         ui->butClearSegments->setDisabled(1);
+        ui->butLoadProtocol->setDisabled(1);
         ui->spinFlowRate->setDisabled(1);
         ui->spinPac->setDisabled(1);
         ui->spinPbc->setDisabled(1);
         ui->butSetComs->setDisabled(1);
 
         ui->butSendProtocol->setDisabled(1);
+        ui->checkStreamRates->setDisabled(1);
 
-        if (!pumpComPort.isEmpty()) {
+        if (!pumpComPort.isEmpty() && !streaming) {
             pumpInterface->startPumps(2);
         }
         if (!condComPort.isEmpty()) {
-            condReadings.clear();
+            // No extra reading here: the sampling grid already takes one at the run start
+            condLatency.clear();
            //qDeb << QTime::currentTime() << "Cleared previous readings";
-            condInterface->getMeasurement();
         }
 
     } else {
@@ -686,11 +733,137 @@ void PumpController::startProtocol()
 void PumpController::sendProtocol()
 {
     // Protocol phases start at Phase 2, so set offset to 1 (to skip first phase).
-    writeToConsole("Sent protocol to pumps", UiBlue);
     qDebug() << tableModel->getSegments();
-    QVector<QVector<PumpPhase>> phases = generatePumpPhases(1, tableModel->getSegments());
+    const QByteArray key = currentProtocolFile().cacheKey(1);
+    QVector<QVector<PumpPhase>> phases;
+    if (phaseCache.lookup(key, &phases)) {
+        writeToConsole("Phase program from cache (" + QString::fromLatin1(key.left(8)) + ")", UiBlue);
+    } else {
+        phases = generatePumpPhases(1, tableModel->getSegments());
+        if (phases.isEmpty()) {
+            return;     // over the phase budget, already reported
+        }
+        phaseCache.store(key, phases);
+    }
+    // Start waits until both pumps have acknowledged the whole program
+    ui->butStartProtocol->setDisabled(1);
+    uploadProgress.clear();
+    uploadingProtocol = true;
     pumpInterface->setPhases(phases);
-    ui->butStartProtocol->setEnabled(1);
+}
+
+ProtocolFile PumpController::currentProtocolFile() const
+{
+    ProtocolFile protocol;
+    protocol.pac = ui->spinPac->value();
+    protocol.pbc = ui->spinPbc->value();
+    protocol.flowRate = ui->spinFlowRate->value();
+    protocol.segments = tableModel->getSegments();
+    return protocol;
+}
+
+void PumpController::saveProtocol()
+{
+    QString defaultDir = experimentDirectory.isEmpty()
+    ? QStandardPaths::writableLocation(QStandardPaths::DesktopLocation)
+    : experimentDirectory;
+
+    QString saveFile = QFileDialog::getSaveFileName(this, tr("Save Protocol"), defaultDir, tr("Protocols (*.json)"));
+    if (saveFile.isEmpty()) {
+        return;
+    }
+    experimentDirectory = QFileInfo(saveFile).absolutePath();  // Update for next time
+    if (!saveFile.endsWith(".json")) {
+        saveFile += ".json";
+    }
+
+    QString error;
+    if (!saveProtocolFile(saveFile, currentProtocolFile(), &error)) {
+        writeToConsole("Could not save protocol: " + error, UiRed);
+        return;
+    }
+    writeToConsole("Saved protocol to " + saveFile, UiYellow);
+}
+
+void PumpController::loadProtocol()
+{
+    QString defaultDir = experimentDirectory.isEmpty()
+    ? QStandardPaths::writableLocation(QStandardPaths::DesktopLocation)
+    : experimentDirectory;
+
+    QString openFile = QFileDialog::getOpenFileName(this, tr("Load Protocol"), defaultDir, tr("Protocols (*.json)"));
+    if (openFile.isEmpty()) {
+        return;
+    }
+    experimentDirectory = QFileInfo(openFile).absolutePath();
+
+    ProtocolFile protocol;
+    QString error;
+    if (!loadProtocolFile(openFile, &protocol, &error)) {
+        writeToConsole("Could not load " + openFile + ": " + error, UiRed);
+        return;
+    }
+    // Changing the pump settings asks for Confirm again, like editing them by hand
+    ui->spinPac->setValue(protocol.pac);
+    ui->spinPbc->setValue(protocol.pbc);
+    ui->spinFlowRate->setValue(protocol.flowRate);
+    tableModel->setSegments(protocol.segments);
+    writeToConsole(QString("Loaded %1 segments from %2").arg(protocol.segments.size()).arg(openFile), UiYellow);
+}
+
+void PumpController::receiveUploadStarted(int commands, double predictedMs)
+{
+    // Phases the pumps already hold aren't sent again
+    writeToConsole(QString("Uploading %1: %2 commands, about %3 s")
+                       .arg(uploadingProtocol ? "protocol" : "pump settings")
+                       .arg(commands).arg(predictedMs / 1000, 0, 'f', 1), UiBlue);
+    if (uploadingProtocol) {
+        ui->butSendProtocol->setDisabled(1);
+    }
+}
+
+void PumpController::receiveUploadProgress(const QString &pump, int done, int total)
+{
+    if (!uploadingProtocol) {
+        return;
+    }
+    uploadProgress[pump] = QString("%1/%2").arg(done).arg(total);
+    QStringList parts;
+    for (auto it = uploadProgress.constBegin(); it != uploadProgress.constEnd(); ++it) {
+        parts << it.key() + " " + it.value();
+    }
+    ui->butSendProtocol->setText(parts.join(", "));
+}
+
+void PumpController::receiveUploadFinished(double elapsedMs, double predictedMs, bool complete)
+{
+    const bool protocol = uploadingProtocol;
+    uploadingProtocol = false;
+    if (!protocol) {
+        if (!complete) {
+            writeToConsole("Pump settings upload incomplete, update them again", UiRed);
+        }
+        return;
+    }
+    ui->butSendProtocol->setText("Send to Pump");
+    if (!runTimer->isActive()) {
+        ui->butSendProtocol->setEnabled(!ui->checkStreamRates->isChecked());
+    }
+    if (!complete) {
+        writeToConsole(QString("Protocol upload incomplete after %1 s, send it again before starting")
+                           .arg(elapsedMs / 1000, 0, 'f', 1), UiRed);
+        return;
+    }
+    if (elapsedMs > 0) {
+        writeToConsole(QString("Protocol uploaded in %1 s (predicted %2 s)")
+                           .arg(elapsedMs / 1000, 0, 'f', 1)
+                           .arg(predictedMs / 1000, 0, 'f', 1), UiGreen);
+    } else {
+        writeToConsole("Pumps already hold this protocol", UiGreen);
+    }
+    if (!runTimer->isActive()) {
+        ui->butStartProtocol->setEnabled(1);
+    }
 }
 
 
@@ -708,12 +881,48 @@ void PumpController::stopProtocol()
     } else {
         writeToConsole("Protocol ended on its own", UiGreen);
     }
+    if (condInterface && condSampleRate > 0) {
+        writeToConsole(QString("Conductivity sampled at %1 samples/s").arg(condSampleRate, 0, 'f', 2), UiBlue);
+    }
+    if (condLatency.count() > 0) {
+        writeToConsole(QString("Meter latency over %1 readings: median %2 ms, p95 %3 ms, max %4 ms")
+                           .arg(condLatency.count())
+                           .arg(condLatency.percentile(0.5), 0, 'f', 0)
+                           .arg(condLatency.percentile(0.95), 0, 'f', 0)
+                           .arg(condLatency.max(), 0, 'f', 0), UiBlue);
+    }
+    for (PlotWidget *plot : {ui->protocolPlot, ui->condPlot}) {
+        ReplotStats stats = plot->replotStats();
+        writeToConsole(QString("%1: %2 replots + %3 cursor-only for %4 updates (%5 coalesced, %6 skipped while hidden)")
+                           .arg(plot->objectName())
+                           .arg(stats.performed)
+                           .arg(stats.cursorOnly)
+                           .arg(stats.requested)
+                           .arg(stats.coalesced)
+                           .arg(stats.skippedHidden), UiBlue);
+    }
+    if (rateStreamer && rateStreamer->isActive()) {
+        rateStreamer->stop();
+        const LatencyHistogram &effect = rateStreamer->latency();
+        writeToConsole(QString("Streamed %1 rate changes (%2 superseded), timer late by at most %3 ms")
+                           .arg(rateStreamer->changesSent())
+                           .arg(rateStreamer->changesSuperseded())
+                           .arg(rateStreamer->maxLateMs(), 0, 'f', 1), UiBlue);
+        if (effect.count() > 0) {
+            writeToConsole(QString("Command to effect: median %1 ms, p95 %2 ms, max %3 ms")
+                               .arg(effect.percentile(0.5), 0, 'f', 0)
+                               .arg(effect.percentile(0.95), 0, 'f', 0)
+                               .arg(effect.max(), 0, 'f', 0), UiBlue);
+        }
+    }
     xPos = -1; // just in case lets reset these
     ui->protocolPlot->setX(-1);
     ui->butStopProtocol->setDisabled(1);
     ui->butStartProtocol->setText("Start");
+    ui->checkStreamRates->setEnabled(1);
     ui->butAddSegment->setEnabled(1);
     ui->butClearSegments->setEnabled(1);
+    ui->butLoadProtocol->setEnabled(1);
     ui->butDeleteSegment->setEnabled(1);
     ui->butSetComs->setEnabled(1);
     ui->spinFlowRate->setEnabled(1);
@@ -724,7 +933,7 @@ void PumpController::stopProtocol()
         ui->butStartPump->setEnabled(1);
         ui->butUpdatePump->setEnabled(1);
         ui->butStopPump->setEnabled(1);
-        ui->butSendProtocol->setEnabled(1);
+        ui->butSendProtocol->setEnabled(!ui->checkStreamRates->isChecked());
         pumpInterface->stopPumps();
     }
 
@@ -732,18 +941,26 @@ void PumpController::stopProtocol()
 
 }
 
-void PumpController::timerTick()
-// At each time point, record a conductivity meter reading and update plot X position
+void PumpController::streamModeChanged(bool streaming)
+// Streaming runs straight from the table, upload mode needs Send first
 {
-    if (condInterface)
-    {
-        //qDebug()<<"requesting Measurement";
-        condInterface->getMeasurement();
+    if (runTimer->isActive()) {
+        return;
+    }
+    bool confirmed = !ui->butConfirmSettings->isEnabled();
+    ui->butStartProtocol->setEnabled(streaming && confirmed);
+    ui->butSendProtocol->setEnabled(!streaming && confirmed && !pumpComPort.isEmpty());
+    if (streaming) {
+        writeToConsole("Streaming mode: rates are sent live, no phase limit", UiBlue);
     }
+}
+
+void PumpController::timerTick()
+// At each time point, update plot X position (CondWorker schedules the readings)
+{
     if (runTimer->isActive())
     {
-        int secsDiff = startTime.secsTo(QTime::currentTime());
-        double elapsedMinutes = secsDiff / 60.0;
+        double elapsedMinutes = (utils::monotonicNs() - runStartNs) / 60e9;
         //qDebug() << "Elapsed:" << elapsedMinutes << "minutes";
 
         ui->protocolPlot->setX(elapsedMinutes);  // move marker to correct X pos based on time
@@ -834,6 +1051,10 @@ QVector<QVector<PumpPhase>> PumpController::generatePumpPhases(const int startPh
         }
     } else
     {
+        // Each pump gets its own spans, so one pump can merge holds while the
+        // other is still ramping
+        QVector<PhaseSpan> spansA;
+        QVector<PhaseSpan> spansB;
         for (const auto& row : segments)
         {
             if (row.size() < 3) continue;
@@ -845,189 +1066,58 @@ QVector<QVector<PumpPhase>> PumpController::generatePumpPhases(const int startPh
             QVector<double> startRates = calculateFlowRates(startConc); // [a_rate, b_rate]
             QVector<double> endRates = calculateFlowRates(endConc);
 
-            // Estimate how many new phases will be added for A and B
-            int newPhasesA = 0, newPhasesB = 0;
-            double totalTimeSec = timeMin * 60;
-
-            if (startConc == endConc)
-            {
-                newPhasesA = (startRates[0] > 0) ? 1 : static_cast<int>(std::ceil(totalTimeSec / 99.0));
-                newPhasesB = (startRates[1] > 0) ? 1 : static_cast<int>(std::ceil(totalTimeSec / 99.0));
-            } else
-            {
-                newPhasesA = 2; // LIN start and end
-                newPhasesB = 2;
-            }
+            spansA.append({ timeMin * 60, startRates[0], endRates[0] });
+            spansB.append({ timeMin * 60, startRates[1], endRates[1] });
+        }
 
-            if ((phaseCounterA + newPhasesA > 40) || (phaseCounterB + newPhasesB > 40))
-            {
-                writeToConsole("########################    WARNING!!!!   ########################", UiRed);
-                writeToConsole("There are too many phases, please reduce!", UiRed);
-                writeToConsole("Pump A: " + QString::number(phaseCounterA + newPhasesA) +"; Pump B: "+ QString::number(phaseCounterB + newPhasesB), UiRed);
-                writeToConsole("The pumps DO NOT match your expected settings!!!", UiRed);
-                break;
-            }
+        // We don't put a stop for the "basic" run, only for protocols
+        PhaseProgram programA = compilePumpPhases(startPhase + 1, spansA, true);
+        PhaseProgram programB = compilePumpPhases(startPhase + 1, spansB, true);
 
-            if (startConc == endConc)
-            {
-                // Constant rate segment — RAT
-                double aRate = startRates[0];
-                double bRate = startRates[1];
-
-                double totalTimeSec = timeMin * 60;
-
-                // Pump A
-                if (aRate > 0)
-                {
-                    double volume = aRate * timeMin;
-                    PumpPhase phaseA;
-                    phaseA.phaseNumber = phaseCounterA;
-                    phaseA.function = "RAT";
-                    phaseA.rate = aRate;
-                    phaseA.volume = volume;
-                    phaseA.direction = "INF";
-                    phasesA.append(phaseA);
-                    phaseCounterA++;
-                } else
-                {
-                    // Pause for pump A
-                    int remaining = static_cast<int>(totalTimeSec);
-                    while (remaining > 0)
-                    {
-                        int chunk = qMin(remaining, 99);
-                        PumpPhase pause;
-                        pause.phaseNumber = phaseCounterA;
-                        pause.function = "PAUSE";
-                        pause.time = QString::number(chunk);//QString("00:%1").arg(chunk, 2, 10, QLatin1Char('0'));
-                        phasesA.append(pause);
-                        remaining -= chunk;
-                        phaseCounterA++;
-                    }
-                }
-
-                // Pump B
-                if (bRate > 0)
-                {
-                    double volume = bRate * timeMin;
-                    PumpPhase phaseB;
-                    phaseB.phaseNumber = phaseCounterB;
-                    phaseB.function = "RAT";
-                    phaseB.rate = bRate;
-                    phaseB.volume = volume;
-                    phaseB.direction = "INF";
-                    phasesB.append(phaseB);
-                    phaseCounterB++;
-                } else
-                {
-                    // Pause for pump B
-                    int remaining = static_cast<int>(totalTimeSec);
-                    while (remaining > 0)
-                    {
-                        int chunk = qMin(remaining, 99);
-                        PumpPhase pause;
-                        pause.phaseNumber = phaseCounterB;
-                        pause.function = "PAUSE";
-                        pause.time = QString::number(chunk);//QString("00:%1").arg(chunk, 2, 10, QLatin1Char('0'));
-                        phasesB.append(pause);
-                        remaining -= chunk;
-                        phaseCounterB++;
-                    }
-                }
-
-            } else
-            {
-                // Linear ramp segment — LIN (two parts)
-                int minutes = static_cast<int>(timeMin);
-                int seconds = static_cast<int>((timeMin - minutes) * 60);
-                int tenths = static_cast<int>(qRound(((timeMin - minutes) * 60 - seconds) * 10));
-
-                // Pump A - Start
-                PumpPhase phaseA_start;
-                phaseA_start.phaseNumber = phaseCounterA;
-                phaseA_start.function = "LIN";
-                phaseA_start.rate = startRates[0];
-                phaseA_start.time = QString("%1:%2").arg(0, 2, 10, QLatin1Char('0')).arg(minutes, 2, 10, QLatin1Char('0'));
-                phaseA_start.direction = "INF";
-                phasesA.append(phaseA_start);
-
-                // Pump A - End
-                PumpPhase phaseA_end;
-                phaseA_end.phaseNumber = phaseCounterA + 1;
-                phaseA_end.function = "LIN";
-                phaseA_end.rate = endRates[0];
-                phaseA_end.time = QString("%1:%2").arg(seconds, 2, 10, QLatin1Char('0')).arg(tenths, 2, 10, QLatin1Char('0'));
-                phaseA_end.direction = "INF";
-                phasesA.append(phaseA_end);
-
-                phaseCounterA += 2;
-
-                // Pump B - Start
-                PumpPhase phaseB_start;
-                phaseB_start.phaseNumber = phaseCounterB;
-                phaseB_start.function = "LIN";
-                phaseB_start.rate = startRates[1];
-                phaseB_start.time = QString("%1:%2").arg(0, 2, 10, QLatin1Char('0')).arg(minutes, 2, 10, QLatin1Char('0'));
-                phaseB_start.direction = "INF";
-                phasesB.append(phaseB_start);
-
-                // Pump B - End
-                PumpPhase phaseB_end;
-                phaseB_end.phaseNumber = phaseCounterB + 1;
-                phaseB_end.function = "LIN";
-                phaseB_end.rate = endRates[1];
-                phaseB_end.time = QString("%1:%2").arg(seconds, 2, 10, QLatin1Char('0')).arg(tenths, 2, 10, QLatin1Char('0'));
-                phaseB_end.direction = "INF";
-                phasesB.append(phaseB_end);
-
-                phaseCounterB += 2;
-            }
-            //qDebug() << "Phases: " << phaseCounterA << phaseCounterB;
-        }
+        writeToConsole(QString("Phase budget: pump A %1/%2, pump B %3/%4 (%5 spans merged)")
+                           .arg(programA.lastPhase).arg(maxPumpPhases)
+                           .arg(programB.lastPhase).arg(maxPumpPhases)
+                           .arg(programA.merged + programB.merged), UiBlue);
 
-        if (startPhase > 0) {
-        // We don't put a stop for the "basic" run
-        // AHH THIS IS BAD LOGIC DESIGN SORRY
-            // Pump A - End
-            PumpPhase phaseA_stop;
-            phaseA_stop.phaseNumber = phaseCounterA;
-            phaseA_stop.function = "STOP";
-            phasesA.append(phaseA_stop);
-           ////qDeb << "Stops: " << phaseCounterA << phaseCounterB;
-
-            // Pump B - Start
-            PumpPhase phaseB_stop;
-            phaseB_stop.phaseNumber = phaseCounterB;
-            phaseB_stop.function = "STOP";
-            phasesB.append(phaseB_stop);
+        if (programA.lastPhase > maxPumpPhases || programB.lastPhase > maxPumpPhases)
+        {
+            writeToConsole("########################    WARNING!!!!   ########################", UiRed);
+            writeToConsole("There are too many phases, please reduce!", UiRed);
+            writeToConsole("Pump A: " + QString::number(programA.lastPhase) +"; Pump B: "+ QString::number(programB.lastPhase), UiRed);
+            writeToConsole("Nothing was sent to the pumps.", UiRed);
+            return {};
         }
+        phasesA = programA.phases;
+        phasesB = programB.phases;
     }
     //qDebug() << "Phases: " << phasesA << phasesB;
     return { phasesA, phasesB };
 }
 
-QVector<double> PumpController::generateRangeScaled(double start, double end, double step)
-/* Wrote this for generating the preY values, using the length of the
- * preYsaved vector as the length. Called by the updateCondPlot function
- */
+void PumpController::journalRunStart(qint64 origin)
+// Opens this run's journal file and writes the pre-run history into it; the
+// readings that follow are appended as they arrive.
 {
-    step = currProtocol->dt();
-    QVector<double> result;
-    // Scale all values by 10 (or 100, 1000 if step is smaller)
-    int scale = 10;
-    int startInt = static_cast<int>(start * scale);
-    int endInt = static_cast<int>(end * scale);
-    int stepInt = static_cast<int>(step * scale);
-
-    for (int i = startInt; i <= endInt; i += stepInt) {
-        result.append(i / static_cast<double>(scale) / 60 ); //convert to minutes
+    if (!condJournal->begin(startTime)) {
+        writeToConsole("Could not open run journal: " + condJournal->errorString(), UiRed);
+        return;
+    }
+    for (const CondSample &sample : condPreReadings) {
+        condJournal->append((sample.t - origin) / 60e9, sample.value);
     }
-
-    return result;
 }
 
 void PumpController::saveCurrentRun()
 {
-    QVector<QVector<double>> data= ui->condPlot->getData();
-    savedRuns.insert(startTime, qMakePair(data.value(0), data.value(1)));
+    if (!condJournal->isOpen() && !condPreReadings.isEmpty()) {
+        // Stopped before the protocol clock started; keep what the plot showed
+        journalRunStart(condPreReadings.last().t);
+    }
+    JournalRun run = condJournal->finish();
+    if (run.rows > 0) {
+        savedRuns.insert(startTime, run);
+    }
     condPreReadings.clear();
+    ui->condPlot->clearData();
+    condPlotOriginNs = 0;
 }
@@ -9,6 +9,11 @@
 #include "pumpcommands.h"
 #include "pumpinterface.h"
 #include "condinterface.h"
+#include "latencyhistogram.h"
+#include "runjournal.h"
+#include "samplering.h"
+#include "ratestreamer.h"
+#include "protocolfile.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui {
@@ -48,6 +53,8 @@ public slots:
     // User button slots
     void startProtocol();
     void sendProtocol();
+    void saveProtocol();
+    void loadProtocol();
     void stopProtocol();
 
     void startPumps();
@@ -58,9 +65,17 @@ public slots:
     void initiateCond();
     void receivePumpError(const QString& err);
     void receivePumpResponse(const QString& msg);
+    void receivePumpsStopped(double latencyMs, int stopsSent);
+    void receivePumpStatus(const PumpStatus& status);
+    void receiveCondSampling(int periodMs, double responseMs);
+    void receiveCondStats(double effectiveHz, double responseMs, int skipped, int timeouts);
     void receiveCondMeasurement(CondReading reading);
 
     void timerTick();
+    void streamModeChanged(bool streaming);
+    void receiveUploadStarted(int commands, double predictedMs);
+    void receiveUploadProgress(const QString &pump, int done, int total);
+    void receiveUploadFinished(double elapsedMs, double predictedMs, bool complete);
 
     void resetCondPlot(); //currently unused
 
@@ -69,7 +84,8 @@ public slots:
 private:
     QTime startTime;
     QString experimentDirectory;
-    QMap<QTime, QPair<QVector<double>, QVector<double>>> savedRuns;
+    QMap<QTime, JournalRun> savedRuns;     // index only, the readings are in the journal files
+    RunJournal *condJournal;
     Ui::PumpController *ui;
     //PumpCommandWorker *commandWorker;
     QString pumpComPort;
@@ -84,14 +100,22 @@ private:
     bool protocolChanged;
     PumpInterface *pumpInterface = nullptr;
     CondInterface *condInterface = nullptr;
-    QVector<double>condReadings;
-    QVector<double> condPreReadings;
+    RateStreamer *rateStreamer = nullptr;   // streaming run mode, lives with pumpInterface
+    QMap<QString, QString> uploadProgress;  // pump name -> "done/total", shown on the Send button
+    bool uploadingProtocol = false;         // as opposed to the single-phase Update Pump program
+    PhaseCache phaseCache;                  // compiled programs by protocol hash
+    SampleRing<CondSample> condPreReadings;    // last condPreSaveWindow readings before a run
+    qint64 condPlotOriginNs = 0;    // x = 0 on condPlot, 0 until the first sample
+    qint64 runStartNs = 0;          // utils::monotonicNs() at the synchronized protocol start
+    LatencyHistogram condLatency;   // GETMEAS request to reply, per run
     int condPreSaveWindow = 60;
+    double condSampleRate = 0;      // Hz, as measured by CondWorker
 
-    void updateCondPlot(); // called upon getting a new measurement
-    void saveCurrentRun(); // stores conductivity plot to a QMap
+    void updateCondPlot(const CondSample &sample); // called upon getting a new measurement
+    void journalRunStart(qint64 origin);
+    void saveCurrentRun(); // closes the run's journal file and indexes it
     QVector<QVector<PumpPhase>> generatePumpPhases(int startPhase, const QVector<QVector<double>>& segments) ;
     QVector<double> calculateFlowRates(double concentration) const;
-    QVector<double> generateRangeScaled(double start, double end, double step = 0.5);
+    ProtocolFile currentProtocolFile() const;
 };
 #endif // PUMPCONTROLLER_H
@@ -0,0 +1,158 @@
+#include "pumpencoder.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+enum class PumpArg {
+    None,
+    Integer,        // rounded to a whole number
+    Fixed1,         // one decimal place
+    Direction,      // > 0 withdraws
+    Clock           // "%02d:%02d"
+};
+
+struct PumpOpcode {
+    PumpCommand cmd;
+    const char *prefix;
+    PumpArg arg;
+    const char *suffix;
+};
+
+// One entry per PumpCommand, in enum order
+constexpr PumpOpcode pumpOpcodes[] = {
+    { PumpCommand::Start,            "RUN",    PumpArg::Integer,   "" },     // RUN [phase]
+    { PumpCommand::Stop,             "STP",    PumpArg::None,      "" },
+    { PumpCommand::GetVersion,       "VER",    PumpArg::None,      "" },
+    { PumpCommand::RateFunction,     "FUNRAT", PumpArg::None,      "" },
+    { PumpCommand::RampFunction,     "FUNLIN", PumpArg::None,      "" },
+    { PumpCommand::PauseFunction,    "FUNPAS", PumpArg::Integer,   "" },
+    { PumpCommand::StopFunction,     "FUNSTP", PumpArg::None,      "" },
+    { PumpCommand::SetPhase,         "PHN",    PumpArg::Integer,   "" },
+    { PumpCommand::SetFlowRate,      "RAT",    PumpArg::Fixed1,    "UM" },   // uL/min
+    { PumpCommand::SetVolume,        "VOL",    PumpArg::Integer,   "" },
+    { PumpCommand::SetFlowDirection, "DIR",    PumpArg::Direction, "" },
+    { PumpCommand::SetRampTime,      "TIM",    PumpArg::Clock,     "" },
+    { PumpCommand::SetVolUnits,      "VOLUL",  PumpArg::None,      "" },     // hardcoded to uL
+    { PumpCommand::SetPause,         "PAS",    PumpArg::Integer,   "" },
+    { PumpCommand::LoopStart,        "FUNLPS", PumpArg::None,      "" },
+    { PumpCommand::LoopEnd,          "FUNLPE", PumpArg::Integer,   "" },     // FUNLPE [repeat count]
+};
+
+constexpr int opcodeCount = sizeof(pumpOpcodes) / sizeof(pumpOpcodes[0]);
+
+constexpr bool opcodesInEnumOrder() {
+    for (int i = 0; i < opcodeCount; ++i) {
+        if (static_cast<int>(pumpOpcodes[i].cmd) != i)
+            return false;
+    }
+    return true;
+}
+
+static_assert(opcodesInEnumOrder(), "pumpOpcodes must list every PumpCommand in enum order");
+static_assert(opcodeCount == static_cast<int>(PumpCommand::LoopEnd) + 1, "pumpOpcodes is missing a PumpCommand");
+
+// The longest command is well under this, so checking once up front is enough
+constexpr int maxCommandLength = 32;
+
+char* writeUInt(char *p, unsigned long long v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+char* writeText(char *p, const char *text) {
+    while (*text)
+        *p++ = *text++;
+    return p;
+}
+
+char* writeArg(char *p, PumpArg arg, double value) {
+    switch (arg) {
+    case PumpArg::None:
+        break;
+    case PumpArg::Integer: {
+        long long v = std::llround(value);
+        if (v < 0) {
+            *p++ = '-';
+            v = -v;
+        }
+        p = writeUInt(p, static_cast<unsigned long long>(v));
+        break;
+    }
+    case PumpArg::Fixed1: {
+        long long tenths = std::llround(value * 10);
+        if (tenths < 0) {
+            *p++ = '-';
+            tenths = -tenths;
+        }
+        p = writeUInt(p, static_cast<unsigned long long>(tenths / 10));
+        *p++ = '.';
+        *p++ = static_cast<char>('0' + tenths % 10);
+        break;
+    }
+    case PumpArg::Direction:
+        p = writeText(p, value > 0 ? "WDR" : "INF");
+        break;
+    case PumpArg::Clock: {
+        int v = static_cast<int>(std::llround(value));
+        int first = (v / 100) % 100;
+        int second = v % 100;
+        *p++ = static_cast<char>('0' + first / 10);
+        *p++ = static_cast<char>('0' + first % 10);
+        *p++ = ':';
+        *p++ = static_cast<char>('0' + second / 10);
+        *p++ = static_cast<char>('0' + second % 10);
+        break;
+    }
+    }
+    return p;
+}
+
+bool appendCommand(PumpPacket &packet, int address, PumpCommand cmd, double value) {
+    int index = static_cast<int>(cmd);
+    if (index < 0 || index >= opcodeCount || address < 0 || address > 99)
+        return false;
+    if (packet.size + maxCommandLength > PumpPacket::capacity)
+        return false;
+
+    const PumpOpcode &op = pumpOpcodes[index];
+    char *p = packet.data + packet.size;
+    p = writeUInt(p, static_cast<unsigned long long>(address));
+    p = writeText(p, op.prefix);
+    p = writeArg(p, op.arg, value);
+    p = writeText(p, op.suffix);
+    packet.size = static_cast<int>(p - packet.data);
+    return true;
+}
+
+} // namespace
+
+bool encodePumpCommand(PumpPacket &packet, int address, PumpCommand cmd, double value) {
+    packet.size = 0;
+    if (!appendCommand(packet, address, cmd, value))
+        return false;
+    packet.data[packet.size++] = '\r';      // Required carriage return
+    return true;
+}
+
+bool appendPumpBurst(PumpPacket &packet, int address, PumpCommand cmd, double value) {
+    if (!appendCommand(packet, address, cmd, value))
+        return false;
+    packet.data[packet.size++] = '*';
+    return true;
+}
+
+bool finishPumpBurst(PumpPacket &packet) {
+    if (packet.size >= PumpPacket::capacity)
+        return false;
+    packet.data[packet.size++] = '\r';
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef PUMPENCODER_H
+#define PUMPENCODER_H
+
+#include "pumpcommands.h"
+
+// Table-driven packet encoder for the NE-1002X pumps. Every PumpCommand has a
+// constexpr opcode template (prefix, argument format, suffix) and the packet is
+// formatted straight into a fixed buffer on the stack, so sending a command
+// doesn't touch the heap.
+//
+// Example usage:
+//  PumpPacket packet;
+//  encodePumpCommand(packet, 1, PumpCommand::SetFlowRate, 125);    // "1RAT125.0UM\r"
+//  serial->write(packet.data, packet.size);
+
+struct PumpPacket {
+    static constexpr int capacity = 128;
+    char data[capacity];
+    int size = 0;
+};
+
+// Single command, "<addr><command>\r"
+bool encodePumpCommand(PumpPacket &packet, int address, PumpCommand cmd, double value = 0);
+
+// Network burst, "<addr><command>*<addr><command>*...\r": append each pump's
+// command, then finish the packet once.
+bool appendPumpBurst(PumpPacket &packet, int address, PumpCommand cmd, double value = 0);
+bool finishPumpBurst(PumpPacket &packet);
+
+// Ramp times are two 2-digit fields ("HH:MM" or "SS:tenths"), carried as first*100 + second
+constexpr double pumpClockValue(int first, int second) {
+    return first * 100 + second;
+}
+
+#endif // PUMPENCODER_H
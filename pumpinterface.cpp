@@ -1,12 +1,14 @@
 #include "pumpinterface.h"
 #include <QDebug>
 #include <QTimer>
+#include <algorithm>
+#include <cmath>
 
 
 /* Interface for the two New Era NE-1002X pumps
  * Example usage:
  *  pumpInterface->broadcastCommand(PumpCommand::Start);
- *  pumpInterface->sendToPump("Pump A", PumpCommand::SetFlowRate, 1.25);
+ *  pumpInterface->sendToPump("PumpA", PumpCommand::SetFlowRate, 1.25);
  */
 
 
@@ -14,39 +16,46 @@
 
 
 PumpInterface::PumpInterface(QObject *parent)
-    : QObject(parent), serial(new QSerialPort(this)) {
-
-    connect(serial, &QSerialPort::readyRead, this, &PumpInterface::handleReadyRead);
-    connect(serial, &QSerialPort::errorOccurred, this, &PumpInterface::handleError);
+    : QObject(parent) {
 
     // Initialize pumps
     pumps = {
         {0, "PumpA"},
         {1, "PumpB"}
     };
+
+    // The worker owns the serial port, so all pump I/O happens on its thread
     workerThread = new QThread;
-    commandWorker = new PumpCommandWorker(this, nullptr);
+    commandWorker = new PumpCommandWorker(nullptr);
     commandWorker->moveToThread(workerThread);
     workerThread->start();
+    QMetaObject::invokeMethod(commandWorker, "initialize", Qt::QueuedConnection); // creates the port after moved
 
     connect(this, &PumpInterface::sendCommandToQueue, commandWorker, &PumpCommandWorker::enqueueCommand, Qt::QueuedConnection);
-    connect(commandWorker, &PumpCommandWorker::pumpCommandReady, this, &PumpInterface::handlePumpCommand, Qt::QueuedConnection);  // <- critical!
-
-
-
+    connect(this, &PumpInterface::sendBurstToQueue, commandWorker, &PumpCommandWorker::enqueueBurst, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::dataReceived, this, &PumpInterface::dataReceived, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::queueEmpty, this, &PumpInterface::queueEmpty, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::commandCompleted, this, &PumpInterface::handleCommandCompleted, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::rttMeasured, this, &PumpInterface::handleRtt, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::commandFailed, this, &PumpInterface::handleCommandFailed, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::errorOccurred, this, &PumpInterface::errorOccurred, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::commandsFlushed, this, &PumpInterface::handleCommandsFlushed, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::pumpsStopped, this, &PumpInterface::handlePumpsStopped, Qt::QueuedConnection);
+    connect(commandWorker, &PumpCommandWorker::statusReceived, this, &PumpInterface::handleStatus, Qt::QueuedConnection);
 }
 
 void PumpInterface::shutdown() {
     if (workerThread) {
+        // this is equivalent to closePort(), on the thread that owns the port
+        QMetaObject::invokeMethod(commandWorker, "closePort", Qt::BlockingQueuedConnection);
         workerThread->quit();
         workerThread->wait();
+        delete commandWorker;
+        commandWorker = nullptr;
         delete workerThread;
         workerThread = nullptr;
     }
-    // this is equivalent to closePort()
-    if (serial->isOpen()) {
-        serial->close();
-    }
+    portOpen = false;
 }
 
 
@@ -54,31 +63,157 @@ PumpInterface::~PumpInterface() {
     shutdown();
 }
 
-void PumpInterface::handlePumpCommand(const QString& name, PumpCommand cmd, QString value) {
-    sendToPump(name, cmd, value);
+void PumpInterface::handleCommandFailed(const AddressedCommand& command, int attempts, PumpError error) {
+    // A rejected phase command means the pump doesn't hold that phase, so it
+    // stays out of the mirror and the upload finishes incomplete
+    confirmPhaseCommand(command, false);
+
+    PumpPacket encoded;
+    encodePumpCommand(encoded, command.address, command.cmd, command.value);
+    QString packet = QString::fromLatin1(encoded.data, encoded.size).trimmed();
+    if (error == PumpError::None) {
+        emit errorOccurred(QString("%1 did not answer %2 after %3 attempts, skipped it.")
+                               .arg(command.name, packet).arg(attempts));
+    } else {
+        emit errorOccurred(QString("%1 rejected %2 (%3), skipped it.")
+                               .arg(command.name, packet, pumpErrorName(error)));
+    }
+    emit commandDropped(command);
+    countUploadCommand(command, false);
 }
 
-bool PumpInterface::connectToPumps(const QString &portName, qint32 baudRate) {
-    if (serial->isOpen()) {
-        serial->close();
+void PumpInterface::handleCommandsFlushed(int count) {
+    // Part of an upload may have been thrown away, so the mirror can't be trusted
+    //qDebug() << "Stop flushed" << count << "commands";
+    Q_UNUSED(count)
+    invalidatePhaseMirror();
+    if (activeUpload) {
+        // Whatever was still queued won't be acknowledged now
+        uploadIncomplete = true;
+        finishUpload();
     }
+}
 
-    serial->setPortName(portName);
-    serial->setBaudRate(baudRate);
-    serial->setDataBits(QSerialPort::Data8);
-    serial->setParity(QSerialPort::NoParity);
-    serial->setStopBits(QSerialPort::OneStop);
-    serial->setFlowControl(QSerialPort::NoFlowControl);
+void PumpInterface::handlePumpsStopped(double latencyMs, int stopsSent) {
+    // The worker times from when it got the request; this includes the hop over from the GUI thread
+    //qDebug() << "Worker stop latency" << latencyMs << "ms";
+    double total = stopClock.isValid() ? stopClock.nsecsElapsed() / 1e6 : latencyMs;
+    emit pumpsStopped(total, stopsSent);
+}
 
-    if (!serial->open(QIODevice::ReadWrite)) {
-        emit errorOccurred("Failed to open port: " + serial->errorString());
-        return false;
+void PumpInterface::handleStatus(const PumpStatus &status) {
+    PumpStatus &cached = statuses[status.address];
+    if (cached != status) {
+        cached = status;
+        emit statusChanged(status);
+    }
+}
+
+void PumpInterface::handleCommandCompleted(const AddressedCommand &command, qint64 repliedNs) {
+    // Only replies without an error get here; '?OOR' and friends come in as failures
+    confirmPhaseCommand(command, true);
+    emit commandCompleted(command, repliedNs);
+    countUploadCommand(command, true);
+}
+
+void PumpInterface::confirmPhaseCommand(const AddressedCommand &command, bool acknowledged) {
+    // A phase only goes into the mirror once every one of its commands has
+    // been acknowledged, so a diff never trusts something still in flight
+    if (!command.upload) {
+        if (!acknowledged) {
+            // Can't tell what that pump holds any more
+            phaseMirror.remove(command.address);
+        }
+        return;
+    }
+    QMap<int, PendingPhase> &pending = pendingPhases[command.address];
+    if (!acknowledged) {
+        if (command.cmd == PumpCommand::SetPhase) {
+            // The rest of this phase went to whatever phase the pump was on
+            phaseMirror.remove(command.address);
+            pending.clear();
+        } else {
+            phaseMirror[command.address].remove(command.phase);
+            pending.remove(command.phase);
+        }
+        return;
+    }
+    auto it = pending.find(command.phase);
+    if (it == pending.end() || it->upload != command.upload) {
+        return;     // superseded by a later upload of the same phase, or failed already
+    }
+    if (--it->outstanding == 0) {
+        phaseMirror[command.address].insert(command.phase, it->phase);
+        pending.erase(it);
     }
+}
 
-    serial->setDataTerminalReady(true);
-    serial->setRequestToSend(true);
+void PumpInterface::handleRtt(int address, double srttMs) {
+    srtt[address] = srttMs;
+}
 
-    //qDebug() << "Port opened successfully:" << serial->portName();
+void PumpInterface::countUploadCommand(const AddressedCommand &command, bool acknowledged) {
+    if (!activeUpload || command.upload != activeUpload) {
+        return;
+    }
+    UploadCount &count = uploadCounts[command.address];
+    ++count.done;
+    if (!acknowledged) {
+        uploadIncomplete = true;
+    }
+    emit uploadProgress(command.name, count.done, count.total);
+
+    for (const UploadCount &pending : uploadCounts) {
+        if (pending.done < pending.total) {
+            return;
+        }
+    }
+    finishUpload();
+}
+
+void PumpInterface::finishUpload() {
+    activeUpload = 0;
+    emit uploadFinished(uploadClock.nsecsElapsed() / 1e6, uploadPredictedMs, !uploadIncomplete);
+}
+
+bool PumpInterface::uploading() const {
+    return activeUpload != 0;
+}
+
+PumpStatus PumpInterface::status(const QString &name) const {
+    for (const Pump &pump : pumps) {
+        if (pump.name == name) {
+            return statuses.value(pump.address);
+        }
+    }
+    return PumpStatus();
+}
+
+QString PumpInterface::pumpName(int address) const {
+    for (const Pump &pump : pumps) {
+        if (pump.address == address) {
+            return pump.name;
+        }
+    }
+    return QString("Pump %1").arg(address);
+}
+
+bool PumpInterface::connectToPumps(const QString &portName, qint32 baudRate) {
+    if (!commandWorker) {
+        return false;
+    }
+    invalidatePhaseMirror();    // could be different (or power-cycled) pumps
+    statuses.clear();
+
+    // Blocks until the I/O thread has the port open (or failed to)
+    bool opened = false;
+    QMetaObject::invokeMethod(commandWorker, [this, portName, baudRate]() {
+        return commandWorker->openPort(portName, baudRate);
+    }, Qt::BlockingQueuedConnection, &opened);
+    portOpen = opened;
+    if (!opened) {
+        return false;
+    }
 
     // Send initial commands (like GetVersion)
     //emit dataReceived("Connecting to pumps! ");
@@ -88,356 +223,254 @@ bool PumpInterface::connectToPumps(const QString &portName, qint32 baudRate) {
 }
 
 
-void PumpInterface::broadcastCommand(PumpCommand cmd, QString value) {
+void PumpInterface::broadcastCommand(PumpCommand cmd, double value) {
+    // One packet for every pump, each still answers (and is retried) on its own
+    int burst = ++burstCounter;
+    QVector<AddressedCommand> commands;
     for (const Pump &pump : pumps) {
         AddressedCommand command;
         command.name = pump.name;
+        command.address = pump.address;
         command.cmd = cmd;
         command.value = value;
-        emit sendCommandToQueue(command);
+        command.burst = burst;
+        command.burstSize = pumps.size();
+        commands.append(command);
     }
+    emit sendBurstToQueue(commands);
 }
 
-void PumpInterface::sendToPump(const QString &name, PumpCommand cmd, QString value) {
+void PumpInterface::sendToPump(const QString &name, PumpCommand cmd, double value) {
     // Primary reference function -- used externally. Requires the name of the pump
     // (which is PumpA or PumpB)
 
     for (const Pump &pump : pumps) {
         if (pump.name == name) {
             //qDebug() << "sendToPump: #"<<pump.address;
-            sendCommand(pump.address, cmd, value);
+            QMetaObject::invokeMethod(commandWorker, [this, pump, cmd, value]() {
+                commandWorker->writeCommand(pump.address, cmd, value);
+            }, Qt::QueuedConnection);
             return;
         }
     }
     emit errorOccurred("Pump with name " + name + " not found.");
 }
 
-void PumpInterface::setPhases(const QVector<QVector<PumpPhase>> &phases)
-{
-    QVector<PumpPhase> aPhases = phases.at(0);
-    QVector<PumpPhase> bPhases = phases.at(1);
-
-    QVector<AddressedCommand> cmdList;
-    foreach (PumpPhase phase, aPhases)
-    {
-        AddressedCommand phaseNumber;
-        phaseNumber.name = "PumpA";
-        phaseNumber.cmd = PumpCommand::SetPhase;
-        phaseNumber.value = QString::number(phase.phaseNumber);
-        emit sendCommandToQueue(phaseNumber);
-
-        if (phase.function == "RAT")
-        {
-            AddressedCommand phaseFunc;
-            phaseFunc.name = "PumpA";
-            phaseFunc.cmd = PumpCommand::RateFunction;
-            emit sendCommandToQueue(phaseFunc);
-
-            AddressedCommand phaseRate;
-            phaseRate.name = "PumpA";
-            phaseRate.cmd = PumpCommand::SetFlowRate;
-            phaseRate.value = QString::number(phase.rate);
-            emit sendCommandToQueue(phaseRate);
-
-            if (phase.volume > 0){
-                // if volume is zero, lets it run forever
-                AddressedCommand phaseVol;
-                phaseVol.name = "PumpA";
-                phaseVol.cmd = PumpCommand::SetVolume;
-                phaseVol.value = QString::number(phase.volume);
-                emit sendCommandToQueue(phaseVol);
-            }
-
-            AddressedCommand phaseDir;
-            phaseDir.name = "PumpA";
-            phaseDir.cmd = PumpCommand::SetFlowDirection;
-            emit sendCommandToQueue(phaseDir);
-        }
-        else if (phase.function == "LIN")
-        {
-            AddressedCommand phaseFunc;
-            phaseFunc.name = "PumpA";
-            phaseFunc.cmd = PumpCommand::RampFunction;
-
-            AddressedCommand phaseRate;
-            phaseRate.name = "PumpA";
-            phaseRate.cmd = PumpCommand::SetFlowRate;
-            phaseRate.value = QString::number(phase.rate);
-
-            AddressedCommand phaseTime;
-            phaseTime.name = "PumpA";
-            phaseTime.cmd = PumpCommand::SetRampTime;
-            phaseTime.value = phase.time;
-
-            AddressedCommand phaseDir;
-            phaseDir.name = "PumpA";
-            phaseDir.cmd = PumpCommand::SetFlowDirection;
-
-            emit sendCommandToQueue(phaseFunc);
-            emit sendCommandToQueue(phaseRate);
-            emit sendCommandToQueue(phaseTime);
-            emit sendCommandToQueue(phaseDir);
-        }
-        else if (phase.function == "PAUSE")
-        {
-            AddressedCommand phaseFunc;
-            phaseFunc.name = "PumpA";
-            phaseFunc.cmd = PumpCommand::PauseFunction;
-            phaseFunc.value = phase.time;
-
-            //AddressedCommand phaseTime;
-            //phaseTime.name = "PumpA";
-            //phaseTime.cmd = PumpCommand::SetPause;
-            //phaseTime.value = phase.time;
-
-            emit sendCommandToQueue(phaseFunc);
-            //emit sendCommandToQueue(phaseTime);
+bool PumpInterface::queueToPump(const QString &name, PumpCommand cmd, double value, qint64 issuedNs) {
+    // Like sendToPump, but goes through the pump's queue so the reply is
+    // matched, retried and reported with commandCompleted/commandDropped
+    if (!portOpen) {
+        emit errorOccurred("Serial port not open.");
+        return false;
+    }
+    for (const Pump &pump : pumps) {
+        if (pump.name == name) {
+            queueCommand(pump, cmd, value, issuedNs);
+            return true;
         }
-        else if (phase.function == "STOP"){
-            AddressedCommand stopPhase;
-            stopPhase.name = "PumpA";
-            stopPhase.cmd = PumpCommand::StopFunction;
-            emit sendCommandToQueue(stopPhase);
+    }
+    emit errorOccurred("Pump with name " + name + " not found.");
+    return false;
+}
+
+int PumpInterface::setPhases(const QVector<QVector<PumpPhase>> &phases)
+{
+    // The worker keeps one queue per pump, so queueing all of A then all of B
+    // still uploads both programs side by side.
+    // A new upload supersedes one still in progress; the old one's remaining
+    // replies no longer count for anything
+    int upload = ++uploadCounter;
+    uploadCounts.clear();
+    uploadIncomplete = false;
+
+    // One command at a time per pump, so each pump takes about commands x RTT
+    // and the upload takes as long as the slower one
+    int queued = 0;
+    double predicted = 0;
+    queueingUpload = upload;
+    for (int i = 0; i < pumps.size() && i < phases.size(); ++i) {
+        const Pump &pump = pumps.at(i);
+        int count = queuePhases(pump, phases.at(i));
+        if (count > 0) {
+            uploadCounts[pump.address].total = count;
+            predicted = std::max(predicted, count * srtt.value(pump.address, assumedRttMs));
         }
+        queued += count;
+    }
+    queueingUpload = 0;
+
+    uploadPredictedMs = predicted;
+    uploadClock.start();
+    if (queued == 0) {
+        // The pumps already hold this program
+        emit uploadFinished(0, 0, true);
+        return 0;
     }
-    //qDebug() << "PUMP B CMDS!!!!";
-    foreach (PumpPhase phase, bPhases)
+    activeUpload = upload;
+    emit uploadStarted(queued, predicted);
+    return queued;
+}
+
+void PumpInterface::invalidatePhaseMirror()
+{
+    phaseMirror.clear();
+    pendingPhases.clear();
+}
+
+int PumpInterface::queuePhases(const Pump &pump, const QVector<PumpPhase> &phases)
+{
+    // Only send what differs from the program this pump has acknowledged.
+    // Queued phases wait in pendingPhases until all their commands are
+    // answered; a failed command drops that phase (or, for PHN, the whole
+    // pump) from the mirror so the next upload sends it in full.
+    const QMap<int, PumpPhase> &mirror = phaseMirror[pump.address];
+    QMap<int, PendingPhase> &pending = pendingPhases[pump.address];
+    int queued = 0;
+
+    foreach (PumpPhase phase, phases)
     {
-        AddressedCommand phaseNumber;
-        phaseNumber.name = "PumpB";
-        phaseNumber.cmd = PumpCommand::SetPhase;
-        phaseNumber.value = QString::number(phase.phaseNumber);
-        emit sendCommandToQueue(phaseNumber);
-
-        if (phase.function == "RAT")
-        {
-            AddressedCommand phaseFunc;
-            phaseFunc.name = "PumpB";
-            phaseFunc.cmd = PumpCommand::RateFunction;
-            emit sendCommandToQueue(phaseFunc);
-
-            AddressedCommand phaseRate;
-            phaseRate.name = "PumpB";
-            phaseRate.cmd = PumpCommand::SetFlowRate;
-            phaseRate.value = QString::number(phase.rate);
-            emit sendCommandToQueue(phaseRate);
-
-            if (phase.volume > 0){
-                // if volume is zero, lets it run forever
-                AddressedCommand phaseVol;
-                phaseVol.name = "PumpB";
-                phaseVol.cmd = PumpCommand::SetVolume;
-                phaseVol.value = QString::number(phase.volume);
-                emit sendCommandToQueue(phaseVol);
-            }
-
-            AddressedCommand phaseDir;
-            phaseDir.name = "PumpB";
-            phaseDir.cmd = PumpCommand::SetFlowDirection;
-            emit sendCommandToQueue(phaseDir);
-        }
-        else if (phase.function == "LIN")
-        {
-            AddressedCommand phaseFunc;
-            phaseFunc.name = "PumpB";
-            phaseFunc.cmd = PumpCommand::RampFunction;
-
-            AddressedCommand phaseRate;
-            phaseRate.name = "PumpB";
-            phaseRate.cmd = PumpCommand::SetFlowRate;
-            phaseRate.value = QString::number(phase.rate);
-
-            AddressedCommand phaseTime;
-            phaseTime.name = "PumpB";
-            phaseTime.cmd = PumpCommand::SetRampTime;
-            phaseTime.value = phase.time;
-
-            AddressedCommand phaseDir;
-            phaseDir.name = "PumpB";
-            phaseDir.cmd = PumpCommand::SetFlowDirection;
-
-            emit sendCommandToQueue(phaseFunc);
-            emit sendCommandToQueue(phaseRate);
-            emit sendCommandToQueue(phaseTime);
-            emit sendCommandToQueue(phaseDir);
-        }
-        else if (phase.function == "PAUSE")
-        {
-            AddressedCommand phaseFunc;
-            phaseFunc.name = "PumpB";
-            phaseFunc.cmd = PumpCommand::PauseFunction;
-            phaseFunc.value = phase.time;
-
-            //AddressedCommand phaseTime;
-            //phaseTime.name = "PumpB";
-            //phaseTime.cmd = PumpCommand::SetPause;
-            //phaseTime.value = phase.time;
-
-            emit sendCommandToQueue(phaseFunc);
-            //emit sendCommandToQueue(phaseTime);
-            //qDebug() << "TIME: " << phase.time;
+        auto known = mirror.constFind(phase.phaseNumber);
+        int count;
+        // A phase still in flight from an earlier upload may already differ
+        // from the mirror, so that one goes out in full
+        if (known == mirror.constEnd() || known->function != phase.function || pending.contains(phase.phaseNumber)) {
+            count = queuePhase(pump, phase, nullptr);
+        } else {
+            count = queuePhase(pump, phase, &known.value());
         }
-        else if (phase.function == "STOP"){
-            AddressedCommand stopPhase;
-            stopPhase.name = "PumpB";
-            stopPhase.cmd = PumpCommand::StopFunction;
-            emit sendCommandToQueue(stopPhase);
+        if (count > 0) {
+            PendingPhase entry;
+            entry.phase = phase;
+            entry.upload = queueingUpload;
+            entry.outstanding = count;
+            pending.insert(phase.phaseNumber, entry);
+        } else {
+            pending.remove(phase.phaseNumber);
         }
+        queued += count;
     }
+    return queued;
 }
 
-bool PumpInterface::startPumps(int phase)
+int PumpInterface::queuePhase(const Pump &pump, const PumpPhase &phase, const PumpPhase *previous)
 {
-    if (!serial->isOpen()) {
-        emit errorOccurred("Serial port not open.");
-        return false;
+    // previous is the same phase as last uploaded (same function), or null to
+    // send everything. Fields are compared at the precision they're sent with.
+    auto changed = [previous](double oldValue, double newValue, double scale) {
+        return !previous || std::llround(oldValue * scale) != std::llround(newValue * scale);
+    };
+
+    QVector<PumpCommand> cmds;
+    QVector<double> values;
+    auto add = [&cmds, &values](PumpCommand cmd, double value = 0) {
+        cmds.append(cmd);
+        values.append(value);
+    };
+
+    if (phase.function == "RAT")
+    {
+        if (!previous)
+            add(PumpCommand::RateFunction);
+        if (changed(previous ? previous->rate : 0, phase.rate, 10))
+            add(PumpCommand::SetFlowRate, phase.rate);
+        if (previous ? changed(previous->volume, phase.volume, 1) : phase.volume > 0){
+            // if volume is zero, lets it run forever
+            add(PumpCommand::SetVolume, phase.volume);
+        }
+        if (!previous || previous->direction != phase.direction)
+            add(PumpCommand::SetFlowDirection, phase.direction == "WDR");
+    }
+    else if (phase.function == "LIN")
+    {
+        if (!previous)
+            add(PumpCommand::RampFunction);
+        if (changed(previous ? previous->rate : 0, phase.rate, 10))
+            add(PumpCommand::SetFlowRate, phase.rate);
+        if (!previous || previous->time != phase.time)
+            add(PumpCommand::SetRampTime, clockValue(phase.time));
+        if (!previous || previous->direction != phase.direction)
+            add(PumpCommand::SetFlowDirection, phase.direction == "WDR");
+    }
+    else if (phase.function == "PAUSE")
+    {
+        if (!previous || previous->time != phase.time)
+            add(PumpCommand::PauseFunction, phase.time.toInt());
+    }
+    else if (phase.function == "LOOP")
+    {
+        if (!previous)
+            add(PumpCommand::LoopStart);
+    }
+    else if (phase.function == "ENDLOOP")
+    {
+        if (!previous || previous->time != phase.time)
+            add(PumpCommand::LoopEnd, phase.time.toInt());
+    }
+    else if (phase.function == "STOP"){
+        if (!previous)
+            add(PumpCommand::StopFunction);
     }
-    QByteArray command = QString("RUN%1").arg(phase).toUtf8();
-    QByteArray packet;
-    packet.append(static_cast<char>('0')+0);
-    packet.append(command);
-    packet.append(static_cast<char>('*'));
-    packet.append(static_cast<char>('0')+1);
-    packet.append(command);
-    packet.append(static_cast<char>('*'));
-    packet.append('\r');
 
+    if (cmds.isEmpty()) {
+        return 0;
+    }
+    queueCommand(pump, PumpCommand::SetPhase, phase.phaseNumber, 0, phase.phaseNumber);
+    for (int i = 0; i < cmds.size(); ++i) {
+        queueCommand(pump, cmds.at(i), values.at(i), 0, phase.phaseNumber);
+    }
+    return cmds.size() + 1;
+}
 
-    qint64 bytesWritten = serial->write(packet);
-   //qDebug() << "Sending to pump: " << packet;
-    return bytesWritten == packet.size();
+void PumpInterface::queueCommand(const Pump &pump, PumpCommand cmd, double value, qint64 issuedNs, int phase)
+{
+    AddressedCommand command;
+    command.name = pump.name;
+    command.address = pump.address;
+    command.cmd = cmd;
+    command.value = value;
+    command.issuedNs = issuedNs;
+    command.upload = queueingUpload;
+    command.phase = phase;
+    emit sendCommandToQueue(command);
 }
 
-bool PumpInterface::stopPumps()
+bool PumpInterface::startPumps(int phase)
 {
-    if (!serial->isOpen()) {
+    // Queued like everything else, so RUN can't overtake a phase upload
+    if (!portOpen) {
         emit errorOccurred("Serial port not open.");
         return false;
     }
-    QByteArray command = "STP";
-    QByteArray packet;
-    packet.append(static_cast<char>('0')+0);
-    packet.append(command);
-    packet.append(static_cast<char>('*'));
-    packet.append(static_cast<char>('0')+1);
-    packet.append(command);
-    packet.append(static_cast<char>('*'));
-    packet.append('\r');
-
-
-    qint64 bytesWritten = serial->write(packet);
-    //qDebug() << "Sending to pump: " << packet;
-    QThread::msleep(30);
-    qint64 bytesWritten2 = serial->write(packet);
-    return bytesWritten+bytesWritten2 == 2*packet.size();
+    broadcastCommand(PumpCommand::Start, phase);
+    return true;
 }
 
-// Private functions
-
-bool PumpInterface::sendCommand(int addr, PumpCommand cmd, QString value) {
-    // Internal function, not for public use.
-    // Write the packet to the address of the pump
-    if (!serial->isOpen()) {
+bool PumpInterface::stopPumps()
+{
+    if (!portOpen) {
         emit errorOccurred("Serial port not open.");
         return false;
     }
-    QByteArray command = buildCommand(cmd, value);
-    QByteArray packet;
-    packet.append(static_cast<char>('0' + addr));
-    packet.append(command);
-
-    qint64 bytesWritten = serial->write(packet);
-    qDebug() << "Sending to pump" << addr << ":" << packet;
-    return bytesWritten == packet.size();
-}
-
-QByteArray PumpInterface::buildCommand(PumpCommand cmd, QString value) {
-    // Base function. Look up the command in our enum, then convert to the
-    // correct pump terminology
-    QByteArray payload;
-
-    switch (cmd) {
-    case PumpCommand::Start:
-        // RUN [phase] will start either the current phase or this number
-        payload = QString("RUN%1").arg(value.toFloat(),0,'f', 0).toUtf8();
-        break;
-    case PumpCommand::Stop:
-        payload = "STP";
-        break;
-    case PumpCommand::RateFunction:
-        payload = QString("FUNRAT").toUtf8();
-        break;
-    case PumpCommand::SetFlowRate:
-        payload = QString("RAT%1UM").arg(value.toFloat(), 0, 'f', 1).toUtf8();
-        break;
-    case PumpCommand::SetVolume:
-        payload = QString("VOL%1").arg(value.toFloat(),0,'f',0).toUtf8();
-        break;
-    case PumpCommand::SetVolUnits:
-        payload = "VOLUL";
-        break;
-    case PumpCommand::SetFlowDirection:
-        // Any value given will set to withdraw
-        payload = (value.toInt() > 0) ? "DIRWDR" : "DIRINF";
-        break;
-    case PumpCommand::SetPhase:
-        payload = QString("PHN%1").arg(value.toInt()).toUtf8();
-        break;
-    case PumpCommand::RampFunction:
-        payload = "FUNLIN";
-        break;
-    case PumpCommand::StopFunction:
-        payload = "FUNSTP";
-        break;
-    case PumpCommand::PauseFunction:
-        payload = QString("FUNPAS%1").arg(value.toInt()).toUtf8();
-        break;
-    case PumpCommand::SetPause:
-        payload = QString("PAS%1").arg(value.toInt()).toUtf8();
-        break;
-    case PumpCommand::SetRampTime:
-        // will be in format (00:00), for HH:MM or SS:Tenths depending on phase
-        payload = QString("TIM%1").arg(value).toUtf8();
-        break;
-    case PumpCommand::GetVersion:
-        payload = "VER";
-        break;
-    }
-
-    payload.append('\r'); // Required carriage return
-    //qDebug() << "buildCommand built as: " << payload;
-    return payload;
-}
-
-void PumpInterface::handleReadyRead() {
-    serialBuffer.append(serial->readAll());
-
-    while (true) {
-        int startIndex = serialBuffer.indexOf(static_cast<char>(0x02));
-        int endIndex = serialBuffer.indexOf(static_cast<char>(0x03), startIndex + 1);
-
-        if (startIndex != -1 && endIndex != -1 && endIndex > startIndex) {
-            // We found a complete frame
-            QByteArray payload = serialBuffer.mid(startIndex + 1, endIndex - startIndex - 1);
-            QString readable = QString::fromLatin1(payload);
-            qDebug() << "Parsed response:" << readable;
-            emit dataReceived(readable);
-
-            // Remove processed data from buffer
-            serialBuffer.remove(0, endIndex + 1);
-        } else {
-            // Either no full frame yet, or partial data still arriving
-            break;
-        }
+    QVector<int> addresses;
+    for (const Pump &pump : pumps) {
+        addresses.append(pump.address);
     }
-
-    // Optionally print buffer contents during debugging
-   //qDebug() << "Current buffer:" << serialBuffer.toHex(' ');
+    stopClock.start();
+    QMetaObject::invokeMethod(commandWorker, [this, addresses]() {
+        commandWorker->stopPumps(addresses);
+    }, Qt::QueuedConnection);
+    return true;
 }
 
+// Private functions
 
-void PumpInterface::handleError(QSerialPort::SerialPortError error) {
-    if (error == QSerialPort::NoError)
-        return;
-    emit errorOccurred("Serial error: " + serial->errorString());
+double PumpInterface::clockValue(const QString &time) {
+    // "00:05" -> the two fields the encoder expects for TIM
+    int colon = time.indexOf(':');
+    if (colon < 0) {
+        return 0;
+    }
+    int first = QStringView(time).left(colon).toInt();
+    int second = QStringView(time).mid(colon + 1).toInt();
+    return pumpClockValue(first, second);
 }
@@ -6,9 +6,11 @@
 #include <QSerialPort>
 #include <QSerialPortInfo>
 #include <QThread>
+#include <QElapsedTimer>
 #include "pumpcommandworker.h"
 
 #include "pumpcommands.h"
+#include "pumpstatus.h"
 
 struct Pump {
     int address;
@@ -23,36 +25,82 @@ public:
     ~PumpInterface();
 
     bool connectToPumps(const QString &portName, qint32 baudRate = QSerialPort::Baud19200);           // initiates connections
-    void broadcastCommand(PumpCommand cmd, QString value = 0);                                      // for basic stuff, like versions
-    void sendToPump(const QString &name, PumpCommand cmd, QString value = 0);
+    void broadcastCommand(PumpCommand cmd, double value = 0);                                        // for basic stuff, like versions
+    void sendToPump(const QString &name, PumpCommand cmd, double value = 0);
+    bool queueToPump(const QString &name, PumpCommand cmd, double value = 0, qint64 issuedNs = 0);  // tracked, see commandCompleted
     void shutdown();
-    void setPhases(const QVector<QVector<PumpPhase>> &phases);
+    int setPhases(const QVector<QVector<PumpPhase>> &phases);                                     // returns commands queued, see upload* signals
+    bool uploading() const;
+    void invalidatePhaseMirror();                                                                   // next setPhases sends everything
+
+    PumpStatus status(const QString &name) const;                                                  // last reply seen, no query sent
+    QString pumpName(int address) const;
 
     bool startPumps(int phase);
-    bool stopPumps();
+    bool stopPumps();                                                                               // async, see pumpsStopped
 
 public slots:
-    void handlePumpCommand(const QString& name, PumpCommand cmd, QString value);
+    void handleCommandFailed(const AddressedCommand& command, int attempts, PumpError error);
+    void handleCommandsFlushed(int count);
+    void handlePumpsStopped(double latencyMs, int stopsSent);
+    void handleStatus(const PumpStatus &status);
+    void handleCommandCompleted(const AddressedCommand &command, qint64 repliedNs);
+    void handleRtt(int address, double srttMs);
 
 
 signals:
     void sendCommandToQueue(const AddressedCommand& command);
+    void sendBurstToQueue(const QVector<AddressedCommand>& commands);
     void dataReceived(const QString &data);
+    void queueEmpty();                                  // every queued command has been answered
+    void pumpsStopped(double latencyMs, int stopsSent); // from the stopPumps call to the last 'S'
+    void statusChanged(const PumpStatus &status);       // state, alarm or error differs from the last reply
+    void commandCompleted(const AddressedCommand &command, qint64 repliedNs);
+    void commandDropped(const AddressedCommand &command);   // gave up after retries
+    void uploadStarted(int commands, double predictedMs);
+    void uploadProgress(const QString &pump, int done, int total);
+    void uploadFinished(double elapsedMs, double predictedMs, bool complete);  // complete: every command acknowledged
     void errorOccurred(const QString &message);
 
-private slots:
-    void handleReadyRead();
-    void handleError(QSerialPort::SerialPortError error);
-
 private:
     QThread *workerThread;
     PumpCommandWorker *commandWorker;
-    QByteArray serialBuffer;
-    QSerialPort *serial;
+    bool portOpen = false;
+    QElapsedTimer stopClock;
     QVector<Pump> pumps;
+    int burstCounter = 0;
+    QMap<int, QMap<int, PumpPhase>> phaseMirror;    // address -> phase number -> last uploaded and acknowledged
+    struct PendingPhase {
+        PumpPhase phase;
+        int upload = 0;
+        int outstanding = 0;                        // commands not yet acknowledged
+    };
+    QMap<int, QMap<int, PendingPhase>> pendingPhases;   // address -> phase number -> queued, not confirmed yet
+    QMap<int, PumpStatus> statuses;                 // address -> latest reply
+    QMap<int, double> srtt;                         // address -> smoothed round trip, ms
+
+    // setPhases upload in progress
+    static constexpr double assumedRttMs = 60;      // until the worker has timed a reply
+    struct UploadCount {
+        int done = 0;
+        int total = 0;
+    };
+    int uploadCounter = 0;
+    int queueingUpload = 0;                         // tags commands while setPhases queues them
+    int activeUpload = 0;
+    bool uploadIncomplete = false;
+    double uploadPredictedMs = 0;
+    QElapsedTimer uploadClock;
+    QMap<int, UploadCount> uploadCounts;            // address -> progress
+
+    void countUploadCommand(const AddressedCommand &command, bool acknowledged);
+    void finishUpload();
 
-    QByteArray buildCommand(PumpCommand cmd, QString value);
-    bool sendCommand(int addr, PumpCommand cmd, QString value = 0);
+    int queuePhases(const Pump &pump, const QVector<PumpPhase> &phases);
+    int queuePhase(const Pump &pump, const PumpPhase &phase, const PumpPhase *previous);
+    void queueCommand(const Pump &pump, PumpCommand cmd, double value = 0, qint64 issuedNs = 0, int phase = 0);
+    void confirmPhaseCommand(const AddressedCommand &command, bool acknowledged);
+    static double clockValue(const QString &time);
 };
 
 #endif // PUMPINTERFACE_H
@@ -0,0 +1,109 @@
+#include "pumpstatus.h"
+
+#include <cstring>
+
+namespace {
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+PumpState stateFor(char prompt) {
+    switch (prompt) {
+    case 'I': return PumpState::Infusing;
+    case 'W': return PumpState::Withdrawing;
+    case 'S': return PumpState::Stopped;
+    case 'P': return PumpState::Paused;
+    case 'T': return PumpState::PausePhase;
+    case 'U': return PumpState::UserWait;
+    case 'X': return PumpState::Purging;
+    case 'A': return PumpState::Alarm;
+    default:  return PumpState::Unknown;
+    }
+}
+
+PumpAlarm alarmFor(char code) {
+    switch (code) {
+    case 'R': return PumpAlarm::Reset;
+    case 'S': return PumpAlarm::Stall;
+    case 'T': return PumpAlarm::Timeout;
+    case 'E': return PumpAlarm::ProgramError;
+    case 'O': return PumpAlarm::PhaseRange;
+    default:  return PumpAlarm::None;
+    }
+}
+
+bool startsWith(const char *data, int size, const char *prefix) {
+    int n = static_cast<int>(std::strlen(prefix));
+    return size >= n && std::memcmp(data, prefix, static_cast<size_t>(n)) == 0;
+}
+
+PumpError errorFor(const char *data, int size) {
+    // data points just past the '?'
+    if (startsWith(data, size, "NA"))  return PumpError::NotApplicable;
+    if (startsWith(data, size, "OOR")) return PumpError::OutOfRange;
+    if (startsWith(data, size, "COM")) return PumpError::Communication;
+    if (startsWith(data, size, "IGN")) return PumpError::Ignored;
+    return PumpError::Syntax;
+}
+
+} // namespace
+
+bool parsePumpStatus(const char *data, int size, PumpStatus &status) {
+    status = PumpStatus();
+    if (size < 2 || !isDigit(data[0]) || !isDigit(data[1]))
+        return false;
+    status.address = (data[0] - '0') * 10 + (data[1] - '0');
+    if (size < 3)
+        return true;
+
+    status.state = stateFor(data[2]);
+    const char *rest = data + 3;
+    int restSize = size - 3;
+    if (restSize > 0 && rest[0] == '?') {
+        if (status.state == PumpState::Alarm)
+            status.alarm = restSize > 1 ? alarmFor(rest[1]) : PumpAlarm::None;
+        else
+            status.error = errorFor(rest + 1, restSize - 1);
+    }
+    return true;
+}
+
+const char* pumpStateName(PumpState state) {
+    switch (state) {
+    case PumpState::Infusing:    return "infusing";
+    case PumpState::Withdrawing: return "withdrawing";
+    case PumpState::Stopped:     return "stopped";
+    case PumpState::Paused:      return "paused";
+    case PumpState::PausePhase:  return "in pause phase";
+    case PumpState::UserWait:    return "waiting for trigger";
+    case PumpState::Purging:     return "purging";
+    case PumpState::Alarm:       return "alarm";
+    case PumpState::Unknown:     break;
+    }
+    return "unknown";
+}
+
+const char* pumpAlarmName(PumpAlarm alarm) {
+    switch (alarm) {
+    case PumpAlarm::Reset:        return "power was reset";
+    case PumpAlarm::Stall:        return "motor stalled";
+    case PumpAlarm::Timeout:      return "communication timeout";
+    case PumpAlarm::ProgramError: return "program error";
+    case PumpAlarm::PhaseRange:   return "phase out of range";
+    case PumpAlarm::None:         break;
+    }
+    return "none";
+}
+
+const char* pumpErrorName(PumpError error) {
+    switch (error) {
+    case PumpError::Syntax:        return "command not recognized";
+    case PumpError::NotApplicable: return "command not applicable now";
+    case PumpError::OutOfRange:    return "value out of range";
+    case PumpError::Communication: return "garbled packet";
+    case PumpError::Ignored:       return "command ignored";
+    case PumpError::None:          break;
+    }
+    return "none";
+}
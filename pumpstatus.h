@@ -0,0 +1,71 @@
+#ifndef PUMPSTATUS_H
+#define PUMPSTATUS_H
+
+// Decoded NE-1002X reply. Every reply is "<2-digit addr><prompt>[data]", where
+// the prompt is the pump's state, and alarms/errors follow the prompt:
+//  "00S"           stopped
+//  "01I"           infusing
+//  "00A?S"         alarm, motor stalled
+//  "01S?OOR"       rejected, value out of range
+// The worker parses each frame once and PumpInterface keeps the latest one per
+// pump, so nothing else has to pick the strings apart.
+//
+// Example usage:
+//  PumpStatus status;
+//  if (parsePumpStatus(frame.data, frame.size, status) && status.isRunning()) { ... }
+
+enum class PumpState : char {
+    Unknown,
+    Infusing,       // I
+    Withdrawing,    // W
+    Stopped,        // S
+    Paused,         // P, after one STP
+    PausePhase,     // T, timing a PAS phase
+    UserWait,       // U, waiting on a trigger
+    Purging,        // X
+    Alarm           // A, see alarm
+};
+
+enum class PumpAlarm : char {
+    None,
+    Reset,          // ?R  power was interrupted
+    Stall,          // ?S  motor stalled
+    Timeout,        // ?T  comms watchdog
+    ProgramError,   // ?E
+    PhaseRange      // ?O  phase out of range
+};
+
+enum class PumpError : char {
+    None,
+    Syntax,         // ?    unrecognized command
+    NotApplicable,  // ?NA  not valid in this state
+    OutOfRange,     // ?OOR
+    Communication,  // ?COM garbled packet, worth resending
+    Ignored         // ?IGN started with another phase
+};
+
+struct PumpStatus {
+    int address = -1;
+    PumpState state = PumpState::Unknown;
+    PumpAlarm alarm = PumpAlarm::None;
+    PumpError error = PumpError::None;
+
+    bool isRunning() const {
+        return state == PumpState::Infusing || state == PumpState::Withdrawing
+               || state == PumpState::PausePhase || state == PumpState::Purging;
+    }
+    bool operator==(const PumpStatus &other) const {
+        return address == other.address && state == other.state
+               && alarm == other.alarm && error == other.error;
+    }
+    bool operator!=(const PumpStatus &other) const { return !(*this == other); }
+};
+
+// False if the frame doesn't even start with an address; status.address is -1 then
+bool parsePumpStatus(const char *data, int size, PumpStatus &status);
+
+const char* pumpStateName(PumpState state);
+const char* pumpAlarmName(PumpAlarm alarm);
+const char* pumpErrorName(PumpError error);
+
+#endif // PUMPSTATUS_H
@@ -0,0 +1,196 @@
+#include "ratestreamer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "protocol.h"
+#include "pumpinterface.h"
+#include "utils.h"
+
+RateStreamer::RateStreamer(PumpInterface *pumps, QObject *parent)
+    : QObject(parent), pumps(pumps), timer(new QTimer(this)) {
+
+    timer->setTimerType(Qt::PreciseTimer);
+    timer->setSingleShot(true);
+    connect(timer, &QTimer::timeout, this, &RateStreamer::tick);
+    connect(pumps, &PumpInterface::commandCompleted, this, &RateStreamer::onCompleted);
+    connect(pumps, &PumpInterface::commandDropped, this, &RateStreamer::onDropped);
+}
+
+void RateStreamer::setRampStep(int ms) {
+    rampStepMs = std::max(100, ms);
+}
+
+bool RateStreamer::isActive() const {
+    return active;
+}
+
+void RateStreamer::start(const Protocol *protocol, RateFunction rates, qint64 originNs) {
+    this->protocol = protocol;
+    this->rates = rates;
+    this->originNs = originNs;
+
+    // Phase 1 gets rewritten on the fly, so whatever was uploaded there is gone
+    pumps->invalidatePhaseMirror();
+
+    // Pump addresses are 0 (A) and 1 (B), same order as the rates
+    channels.clear();
+    for (int address = 0; address < 2; ++address) {
+        Channel channel;
+        channel.name = pumps->pumpName(address);
+        channels.append(channel);
+    }
+    effect.clear();
+    lateMs = 0;
+    sentCount = 0;
+    supersededCount = 0;
+
+    active = true;
+    schedule(originNs);
+}
+
+void RateStreamer::stop() {
+    // The pumps themselves are stopped by whoever stops the run
+    active = false;
+    timer->stop();
+    for (Channel &channel : channels) {
+        channel.busy = false;
+    }
+}
+
+const LatencyHistogram& RateStreamer::latency() const {
+    return effect;
+}
+
+double RateStreamer::maxLateMs() const {
+    return lateMs;
+}
+
+int RateStreamer::changesSent() const {
+    return sentCount;
+}
+
+int RateStreamer::changesSuperseded() const {
+    return supersededCount;
+}
+
+void RateStreamer::schedule(qint64 deadline) {
+    deadlineNs = deadline;
+    qint64 remaining = deadline - utils::monotonicNs();
+    // Round up, a wake-up just after the deadline beats spinning just before it
+    timer->start(static_cast<int>(std::max<qint64>(0, (remaining + 999999) / 1000000)));
+}
+
+qint64 RateStreamer::nextEvent(double minutes) const {
+    const QVector<double> &times = protocol->times();
+    const QVector<double> &values = protocol->values();
+    if (times.isEmpty() || minutes >= times.last()) {
+        return -1;
+    }
+    // Breakpoints come in pairs, so the one after t ends the segment t is in
+    int i = static_cast<int>(std::upper_bound(times.constBegin(), times.constEnd(), minutes) - times.constBegin());
+    double next = times[i];
+    if (i > 0 && values[i - 1] != values[i]) {
+        // Ramp: follow it in steps, landing exactly on its end
+        next = std::min(next, minutes + rampStepMs / 60000.0);
+    }
+    return originNs + std::llround(next * 60e9);
+}
+
+void RateStreamer::tick() {
+    if (!active) {
+        return;
+    }
+    const qint64 now = utils::monotonicNs();
+    lateMs = std::max(lateMs, (now - deadlineNs) / 1e6);
+
+    // Protocol time of the scheduled event, not of the wake-up. The extra
+    // microsecond puts a boundary firmly in the segment that starts there.
+    const double minutes = (deadlineNs - originNs + 1000) / 60e9;
+    QVector<double> target = rates(protocol->valueAt(minutes));
+    for (int i = 0; i < channels.size() && i < target.size(); ++i) {
+        request(channels[i], target[i], deadlineNs);
+    }
+
+    qint64 next = nextEvent(minutes);
+    if (next >= 0) {
+        schedule(next);
+    }
+    // Past the end the run timer stops everything
+}
+
+void RateStreamer::request(Channel &channel, double rate, qint64 dueNs) {
+    rate = std::llround(rate * 10) / 10.0;      // what RAT can carry
+    if (channel.busy) {
+        // Only the newest rate matters once the pump is free again
+        if (channel.target != channel.sent && channel.target != rate) {
+            ++supersededCount;
+        }
+        channel.target = rate;
+        channel.targetNs = dueNs;
+        return;
+    }
+    channel.target = rate;
+    channel.targetNs = dueNs;
+    if (rate != channel.sent) {
+        send(channel, rate, dueNs);
+    }
+}
+
+void RateStreamer::send(Channel &channel, double rate, qint64 dueNs) {
+    channel.sent = rate;
+    if (rate <= 0) {
+        if (!channel.running) {
+            return;     // already not pumping
+        }
+        // A running pump pauses on the first STP; RUN picks it up again later
+        channel.running = false;
+        channel.busy = pumps->queueToPump(channel.name, PumpCommand::Stop, 0, dueNs);
+    } else if (channel.running) {
+        channel.busy = pumps->queueToPump(channel.name, PumpCommand::SetFlowRate, rate, dueNs);
+    } else {
+        // Phase 1 as an endless RAT phase at this rate, then run it. Only the
+        // RUN carries the timestamp, its reply is when the pump takes effect.
+        pumps->queueToPump(channel.name, PumpCommand::SetPhase, 1);
+        pumps->queueToPump(channel.name, PumpCommand::RateFunction);
+        pumps->queueToPump(channel.name, PumpCommand::SetFlowRate, rate);
+        pumps->queueToPump(channel.name, PumpCommand::SetVolume, 0);
+        pumps->queueToPump(channel.name, PumpCommand::SetFlowDirection, 0);
+        channel.running = true;
+        channel.busy = pumps->queueToPump(channel.name, PumpCommand::Start, 1, dueNs);
+    }
+    if (channel.busy) {
+        ++sentCount;
+    }
+}
+
+void RateStreamer::onCompleted(const AddressedCommand &command, qint64 repliedNs) {
+    if (!active || command.issuedNs == 0) {
+        return;     // not one of ours, or a setup step
+    }
+    for (Channel &channel : channels) {
+        if (channel.name != command.name || !channel.busy) {
+            continue;
+        }
+        effect.add((repliedNs - command.issuedNs) / 1e6);
+        channel.busy = false;
+        if (channel.target != channel.sent) {
+            send(channel, channel.target, channel.targetNs);
+        }
+    }
+}
+
+void RateStreamer::onDropped(const AddressedCommand &command) {
+    if (!active) {
+        return;
+    }
+    for (Channel &channel : channels) {
+        if (channel.name != command.name || !channel.busy) {
+            continue;
+        }
+        // Don't know what the pump is doing now; the next event sends again
+        channel.busy = false;
+        channel.sent = -1;
+        emit errorOccurred(QString("%1 missed a streamed rate change.").arg(channel.name));
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef RATESTREAMER_H
+#define RATESTREAMER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <functional>
+
+#include "latencyhistogram.h"
+
+class Protocol;
+class PumpInterface;
+struct AddressedCommand;
+
+// Runs a protocol by sending rates live instead of uploading a phase program:
+// phase 1 is a plain RAT phase and the host changes its rate as the protocol
+// goes. Holds only need a command at their boundaries, ramps are followed with
+// a RAT update every rampStepMs. No phase limit and nothing to upload first.
+//
+// Each pump has at most one change in flight. If the protocol moves on before
+// the pump has answered, only the newest rate is sent next. A zero rate pauses
+// the pump (STP), and a paused pump is restarted with RAT + RUN.
+//
+// Command-to-effect latency runs from the scheduled time of a change to the
+// pump's reply to the command that applies it, so it includes timer slop,
+// queueing and the serial round trip.
+//
+// Example usage:
+//  streamer->start(protocol, [this](double conc) { return calculateFlowRates(conc); }, utils::monotonicNs());
+//  ...
+//  streamer->stop();
+
+class RateStreamer : public QObject {
+    Q_OBJECT
+
+public:
+    using RateFunction = std::function<QVector<double>(double)>;    // concentration -> {A, B} uL/min
+
+    explicit RateStreamer(PumpInterface *pumps, QObject *parent = nullptr);
+
+    void setRampStep(int ms);
+    bool isActive() const;
+
+    void start(const Protocol *protocol, RateFunction rates, qint64 originNs);
+    void stop();
+
+    const LatencyHistogram& latency() const;        // command to effect, ms
+    double maxLateMs() const;                       // worst timer wake-up after its deadline
+    int changesSent() const;
+    int changesSuperseded() const;                  // replaced by a newer rate before they went out
+
+signals:
+    void errorOccurred(const QString &message);
+
+private:
+    struct Channel {
+        QString name;
+        double sent = -1;           // last rate sent, -1 before the first (or after a drop)
+        double target = -1;         // newest rate asked for; sent once the pump is free
+        qint64 targetNs = 0;
+        bool busy = false;
+        bool running = false;
+    };
+
+    static constexpr int defaultRampStepMs = 1000;
+
+    void tick();
+    void schedule(qint64 deadline);
+    qint64 nextEvent(double minutes) const;
+    void request(Channel &channel, double rate, qint64 dueNs);
+    void send(Channel &channel, double rate, qint64 dueNs);
+    void onCompleted(const AddressedCommand &command, qint64 repliedNs);
+    void onDropped(const AddressedCommand &command);
+
+    PumpInterface *pumps;
+    QTimer *timer;
+    const Protocol *protocol = nullptr;
+    RateFunction rates;
+    qint64 originNs = 0;
+    qint64 deadlineNs = 0;
+    int rampStepMs = defaultRampStepMs;
+    bool active = false;
+    QVector<Channel> channels;
+
+    LatencyHistogram effect;
+    double lateMs = 0;
+    int sentCount = 0;
+    int supersededCount = 0;
+};
+
+#endif // RATESTREAMER_H
@@ -0,0 +1,175 @@
+#include "runjournal.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTimer>
+
+#include <memory>
+#include <vector>
+
+RunJournal::RunJournal(QObject *parent)
+    : QObject(parent), flushTimer(new QTimer(this)) {
+    flushTimer->setSingleShot(true);
+    connect(flushTimer, &QTimer::timeout, this, &RunJournal::flush);
+}
+
+RunJournal::~RunJournal() {
+    finish();
+}
+
+QString RunJournal::directory() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/journal";
+}
+
+bool RunJournal::begin(const QTime &start) {
+    finish();
+
+    QDir dir(directory());
+    if (!dir.mkpath(".")) {
+        error = "Could not create " + dir.path();
+        return false;
+    }
+
+    // Date in the name too, so runs from different days never collide
+    const QString name = QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz") + ".csv";
+    file.setFileName(dir.filePath(name));
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+        error = file.errorString();
+        return false;
+    }
+
+    current = JournalRun();
+    current.start = start;
+    current.path = file.fileName();
+    return true;
+}
+
+void RunJournal::append(double minutes, double value) {
+    if (!file.isOpen()) {
+        return;
+    }
+    pending += QByteArray::number(minutes, 'f', 6);
+    pending += ',';
+    pending += QByteArray::number(value, 'f', 6);
+    pending += '\n';
+    ++current.rows;
+
+    if (++pendingRows >= flushRows) {
+        flush();
+    } else if (!flushTimer->isActive()) {
+        flushTimer->start(flushIntervalMs);
+    }
+}
+
+void RunJournal::flush() {
+    flushTimer->stop();
+    if (pending.isEmpty() || !file.isOpen()) {
+        return;
+    }
+    if (file.write(pending) != pending.size()) {
+        error = file.errorString();
+    }
+    file.flush();
+    pending.clear();
+    pendingRows = 0;
+}
+
+JournalRun RunJournal::finish() {
+    if (!file.isOpen()) {
+        return JournalRun();
+    }
+    flush();
+    file.close();
+    JournalRun run = current;
+    current = JournalRun();
+    return run;
+}
+
+bool RunJournal::isOpen() const {
+    return file.isOpen();
+}
+
+QString RunJournal::errorString() const {
+    return error;
+}
+
+bool RunJournal::exportCsv(const QVector<JournalRun> &runs, const QString &path, QString *error) {
+    QFile out(path);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        *error = out.errorString();
+        return false;
+    }
+
+    std::vector<std::unique_ptr<QFile>> inputs;
+    for (const JournalRun &run : runs) {
+        auto in = std::make_unique<QFile>(run.path);
+        if (!in->open(QIODevice::ReadOnly | QIODevice::Text)) {
+            *error = run.path + ": " + in->errorString();
+            return false;
+        }
+        inputs.push_back(std::move(in));
+    }
+
+    // --- Write the header ---
+    QByteArray line;
+    for (int i = 0; i < runs.size(); ++i) {
+        line += "\"" + runs[i].start.toString("HH:mm:ss").toLatin1() + "\",\"\"";
+        if (i + 1 < runs.size()) {
+            line += ",";
+        }
+    }
+    line += "\n";
+    out.write(line);
+
+    // --- One row from every run at a time; runs that ran out leave their columns empty ---
+    bool more = true;
+    while (more) {
+        more = false;
+        line.clear();
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            QByteArray row = inputs[i]->readLine().trimmed();
+            if (row.isEmpty()) {
+                line += ",";
+            } else {
+                line += row;
+                more = true;
+            }
+            if (i + 1 < inputs.size()) {
+                line += ",";
+            }
+        }
+        if (more) {
+            line += "\n";
+            out.write(line);
+        }
+    }
+    // A full disk shows up here, not as a failed open
+    if (!out.flush() || out.error() != QFileDevice::NoError) {
+        *error = out.errorString();
+        return false;
+    }
+    return true;
+}
+
+int RunJournal::prune(int days) {
+    const QDateTime cutoff = QDateTime::currentDateTime().addDays(-days);
+    QDir dir(directory());
+    int removed = 0;
+    const QFileInfoList files = dir.entryInfoList({"*.csv"}, QDir::Files);
+    for (const QFileInfo &info : files) {
+        if (info.lastModified() < cutoff && QFile::remove(info.filePath())) {
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+void RunJournal::remove(const QVector<JournalRun> &runs) {
+    for (const JournalRun &run : runs) {
+        if (!run.path.isEmpty()) {
+            QFile::remove(run.path);
+        }
+    }
+}
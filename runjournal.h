@@ -0,0 +1,72 @@
+#ifndef RUNJOURNAL_H
+#define RUNJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QTime>
+#include <QVector>
+
+class QTimer;
+
+// Append-only on-disk record of conductivity runs. Each run gets its own file
+// of "minutes,mS/cm" lines in the journal directory, written as readings come
+// in and flushed in batches (every flushRows lines or flushIntervalMs,
+// whichever is first), so a long session doesn't grow in memory and a crash
+// loses at most a couple of seconds. PumpController only keeps the index.
+//
+// Files don't pile up: runs that were exported are removed when the session
+// ends, and at startup anything older than keepDays goes (a run that was never
+// exported, or survived a crash, stays around until then).
+//
+// Example usage:
+//  RunJournal::prune();                    // once, at startup
+//  journal->begin(startTime);
+//  journal->append(minutes, value);        // per reading
+//  JournalRun run = journal->finish();
+//  RunJournal::exportCsv(runs, "out.csv", &error);
+//  RunJournal::remove(exportedRuns);       // on the way out
+
+struct JournalRun {
+    QTime start;
+    QString path;
+    qint64 rows = 0;
+    bool exported = false;
+};
+
+class RunJournal : public QObject {
+    Q_OBJECT
+
+public:
+    explicit RunJournal(QObject *parent = nullptr);
+    ~RunJournal();
+
+    bool begin(const QTime &start);
+    void append(double minutes, double value);
+    JournalRun finish();
+    bool isOpen() const;
+    QString errorString() const;
+
+    static QString directory();
+    // Streams the runs side by side into one CSV (same layout the old in-memory export wrote)
+    static bool exportCsv(const QVector<JournalRun> &runs, const QString &path, QString *error);
+    // Deletes journal files last written more than keepDays ago; returns how many
+    static int prune(int days = keepDays);
+    static void remove(const QVector<JournalRun> &runs);
+
+    static constexpr int keepDays = 7;
+
+private:
+    void flush();
+
+    static constexpr int flushRows = 32;
+    static constexpr int flushIntervalMs = 2000;
+
+    QFile file;
+    QByteArray pending;
+    int pendingRows = 0;
+    QTimer *flushTimer;
+    JournalRun current;
+    QString error;
+};
+
+#endif // RUNJOURNAL_H
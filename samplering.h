@@ -0,0 +1,72 @@
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <algorithm>
+#include <vector>
+
+// Fixed-capacity ring that always keeps its contents in one contiguous span,
+// oldest first. Every element is stored twice, at i and i + capacity, so the
+// window [head, head + size) never wraps: push is O(1), and the plot can walk
+// data()..data() + size() without copying or unrolling the ring.
+//
+// Example usage:
+//  SampleRing<CondSample> history(60);
+//  history.push(sample);                  // drops the oldest once full
+//  for (const CondSample &s : history) { ... }
+
+template <typename T>
+class SampleRing {
+public:
+    explicit SampleRing(int capacity = 1) { setCapacity(capacity); }
+
+    // Keeps the newest elements that still fit
+    void setCapacity(int capacity) {
+        capacity = std::max(1, capacity);
+        if (capacity == cap)
+            return;
+        std::vector<T> kept(begin() + std::max(0, count - capacity), end());
+        cap = capacity;
+        storage.assign(static_cast<size_t>(2 * cap), T());
+        head = 0;
+        count = 0;
+        for (const T &value : kept)
+            push(value);
+    }
+
+    void push(const T &value) {
+        int slot;
+        if (count < cap) {
+            slot = head + count;
+            ++count;
+        } else {
+            slot = head;
+            head = head + 1 == cap ? 0 : head + 1;
+        }
+        slot %= cap;
+        storage[static_cast<size_t>(slot)] = value;
+        storage[static_cast<size_t>(slot + cap)] = value;
+    }
+
+    void clear() {
+        head = 0;
+        count = 0;
+    }
+
+    int size() const { return count; }
+    int capacity() const { return cap; }
+    bool isEmpty() const { return count == 0; }
+
+    const T* data() const { return storage.data() + head; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + count; }
+    const T& first() const { return data()[0]; }
+    const T& last() const { return data()[count - 1]; }
+
+private:
+    std::vector<T> storage;
+    int cap = 0;
+    int head = 0;       // oldest element
+    int count = 0;
+};
+
+#endif // SAMPLERING_H
@@ -0,0 +1,111 @@
+#include "serialframer.h"
+
+#include <algorithm>
+#include <cstring>
+
+static int roundUpPow2(int n)
+{
+    int p = 64;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+SerialFramer::SerialFramer(char startByte, char endByte, int capacity)
+    : startByte(startByte), endByte(endByte),
+    mask(static_cast<std::uint64_t>(roundUpPow2(capacity)) - 1),
+    ring(roundUpPow2(capacity)), scratch(roundUpPow2(capacity)) {}
+
+char* SerialFramer::writePtr(int *contiguous) {
+    if (size() == capacity()) {
+        // A frame longer than the whole ring is line noise; start over
+        readPos = scanPos = writePos;
+        inFrame = false;
+        ++overflowCount;
+    }
+    std::uint64_t offset = writePos & mask;
+    std::uint64_t toEnd = ring.size() - offset;
+    std::uint64_t free = ring.size() - (writePos - readPos);
+    *contiguous = static_cast<int>(std::min(toEnd, free));
+    return ring.data() + offset;
+}
+
+void SerialFramer::commit(int n) {
+    if (n > 0)
+        writePos += static_cast<std::uint64_t>(n);
+}
+
+int SerialFramer::append(const char *bytes, int n) {
+    int room = 0;
+    char *dst = writePtr(&room);
+    int chunk = std::min(room, n);
+    std::memcpy(dst, bytes, static_cast<size_t>(chunk));
+    commit(chunk);
+    return chunk;
+}
+
+bool SerialFramer::next(FrameView &frame) {
+    while (scanPos < writePos) {
+        const char c = ring[scanPos & mask];
+
+        if (startByte && c == startByte) {
+            // A new STX also resyncs past a frame that lost its ETX
+            inFrame = true;
+            readPos = scanPos;
+            frameStart = ++scanPos;
+            continue;
+        }
+
+        if (c == endByte) {
+            if (startByte && !inFrame) {
+                // ETX without an STX
+                readPos = ++scanPos;
+                continue;
+            }
+            std::uint64_t begin = startByte ? frameStart : readPos;
+            frame = view(begin, scanPos);
+            readPos = ++scanPos;
+            inFrame = false;
+            return true;
+        }
+        ++scanPos;
+    }
+
+    if (startByte && !inFrame) {
+        // Nothing before an STX is worth keeping
+        readPos = scanPos;
+    }
+    return false;
+}
+
+FrameView SerialFramer::view(std::uint64_t begin, std::uint64_t end) {
+    FrameView frame;
+    frame.size = static_cast<int>(end - begin);
+    std::uint64_t offset = begin & mask;
+    if (offset + static_cast<std::uint64_t>(frame.size) <= ring.size()) {
+        frame.data = ring.data() + offset;
+    } else {
+        size_t first = ring.size() - offset;
+        std::memcpy(scratch.data(), ring.data() + offset, first);
+        std::memcpy(scratch.data() + first, ring.data(), static_cast<size_t>(frame.size) - first);
+        frame.data = scratch.data();
+    }
+    return frame;
+}
+
+void SerialFramer::clear() {
+    readPos = scanPos = writePos = frameStart = 0;
+    inFrame = false;
+}
+
+int SerialFramer::size() const {
+    return static_cast<int>(writePos - readPos);
+}
+
+int SerialFramer::capacity() const {
+    return static_cast<int>(ring.size());
+}
+
+int SerialFramer::overflows() const {
+    return overflowCount;
+}
@@ -0,0 +1,60 @@
+#ifndef SERIALFRAMER_H
+#define SERIALFRAMER_H
+
+#include <vector>
+#include <cstdint>
+
+// Incremental framer shared by PumpInterface (STX ... ETX) and CondInterface
+// (... '>'). Bytes land in a fixed ring buffer, the scan resumes where the last
+// call stopped, and complete frames are handed out as views into the ring, so
+// a burst of replies is scanned once and never shuffled to the front.
+//
+// Example usage:
+//  char *dst = framer.writePtr(&room);
+//  framer.commit(serial->read(dst, room));
+//  while (framer.next(frame)) { ... frame.data, frame.size ... }
+
+struct FrameView {
+    const char *data = nullptr;     // without the delimiters
+    int size = 0;
+};
+
+class SerialFramer {
+public:
+    // startByte 0 means frames are delimited by endByte alone
+    explicit SerialFramer(char startByte, char endByte, int capacity = 4096);
+
+    // Contiguous free space at the write end. If the ring is full of a frame
+    // that never ended, that data is dropped to make room.
+    char* writePtr(int *contiguous);
+    void commit(int n);
+    // Copies as much as fits in one go; drain with next() before appending the rest
+    int append(const char *bytes, int n);
+
+    // The view stays valid until the next writePtr/append
+    bool next(FrameView &frame);
+
+    void clear();
+    int size() const;
+    int capacity() const;
+    int overflows() const;
+
+private:
+    FrameView view(std::uint64_t begin, std::uint64_t end);
+
+    char startByte;
+    char endByte;
+    std::uint64_t mask;
+    std::vector<char> ring;
+    std::vector<char> scratch;      // only used when a frame wraps around the end
+
+    // Absolute byte positions, taken modulo the capacity when indexing
+    std::uint64_t readPos = 0;      // oldest byte still needed
+    std::uint64_t scanPos = 0;      // next byte to look at
+    std::uint64_t writePos = 0;
+    std::uint64_t frameStart = 0;
+    bool inFrame = false;
+    int overflowCount = 0;
+};
+
+#endif // SERIALFRAMER_H
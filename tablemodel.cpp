@@ -132,6 +132,21 @@ void TableModel::clearSegments() {
     emit segmentsChanged();
 }
 
+void TableModel::setSegments(const QVector<QVector<double>>& segments) {
+    beginResetModel();
+    tableData.clear();
+    for (const auto& seg : segments) {
+        if (seg.size() != 3) continue;  // Expecting [duration, start, end]
+        QVector<QString> row;
+        row.push_back(QString::number(seg[0]));
+        row.push_back(QString::number(static_cast<int>(seg[1])));
+        row.push_back(QString::number(static_cast<int>(seg[2])));
+        tableData.push_back(row);
+    }
+    endResetModel();
+    emit segmentsChanged();
+}
+
 void TableModel::updateSegments() {
     emit segmentsChanged();
 }
@@ -0,0 +1,148 @@
+#include "ptydevice.h"
+
+#include <QFile>
+#include <QSocketNotifier>
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+PtyDevice::PtyDevice(QObject *parent) : QObject(parent) {}
+
+PtyDevice::~PtyDevice() {
+    close();
+}
+
+bool PtyDevice::open(const QString &linkPath) {
+    close();
+
+    masterFd = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (masterFd < 0) {
+        error = QString("posix_openpt failed: %1").arg(std::strerror(errno));
+        return false;
+    }
+    if (::grantpt(masterFd) != 0 || ::unlockpt(masterFd) != 0) {
+        error = QString("grantpt/unlockpt failed: %1").arg(std::strerror(errno));
+        close();
+        return false;
+    }
+
+    const char *name = ::ptsname(masterFd);
+    if (!name) {
+        error = "ptsname failed";
+        close();
+        return false;
+    }
+    slave = QString::fromLocal8Bit(name);
+
+    // Raw mode, otherwise the line discipline turns the pumps' '\r' into '\n'
+    slaveFd = ::open(name, O_RDWR | O_NOCTTY);
+    if (slaveFd >= 0) {
+        termios tio;
+        if (::tcgetattr(slaveFd, &tio) == 0) {
+            ::cfmakeraw(&tio);
+            ::tcsetattr(slaveFd, TCSANOW, &tio);
+        }
+    }
+
+    ::fcntl(masterFd, F_SETFL, ::fcntl(masterFd, F_GETFL) | O_NONBLOCK);
+
+    notifier = new QSocketNotifier(masterFd, QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &PtyDevice::readPending);
+
+    if (!linkPath.isEmpty()) {
+        QFile::remove(linkPath);
+        if (!QFile::link(slave, linkPath)) {
+            error = "Could not create symlink " + linkPath;
+            close();
+            return false;
+        }
+        link = linkPath;
+    }
+    return true;
+}
+
+void PtyDevice::close() {
+    if (notifier) {
+        notifier->setEnabled(false);
+        delete notifier;
+        notifier = nullptr;
+    }
+    if (slaveFd >= 0) {
+        ::close(slaveFd);
+        slaveFd = -1;
+    }
+    if (masterFd >= 0) {
+        ::close(masterFd);
+        masterFd = -1;
+    }
+    if (!link.isEmpty()) {
+        QFile::remove(link);
+        link.clear();
+    }
+}
+
+bool PtyDevice::write(const QByteArray &data) {
+    if (masterFd < 0)
+        return false;
+
+    const char *p = data.constData();
+    qint64 remaining = data.size();
+    while (remaining > 0) {
+        ssize_t n = ::write(masterFd, p, static_cast<size_t>(remaining));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Slave side isn't reading; wait for room instead of spinning,
+                // but don't hang forever if nobody ever opens it
+                pollfd pfd = {masterFd, POLLOUT, 0};
+                int ready = ::poll(&pfd, 1, writeTimeoutMs);
+                if (ready > 0 || (ready < 0 && errno == EINTR))
+                    continue;
+                error = ready == 0 ? QString("write timed out, nobody is reading the pty")
+                                   : QString("poll failed: %1").arg(std::strerror(errno));
+                return false;
+            }
+            error = QString("write failed: %1").arg(std::strerror(errno));
+            return false;
+        }
+        p += n;
+        remaining -= n;
+    }
+    return true;
+}
+
+QString PtyDevice::slavePath() const {
+    return slave;
+}
+
+QString PtyDevice::linkPath() const {
+    return link.isEmpty() ? slave : link;
+}
+
+QString PtyDevice::errorString() const {
+    return error;
+}
+
+void PtyDevice::readPending() {
+    char buf[4096];
+    QByteArray data;
+    while (true) {
+        ssize_t n = ::read(masterFd, buf, sizeof(buf));
+        if (n > 0) {
+            data.append(buf, static_cast<int>(n));
+            continue;
+        }
+        // EAGAIN: drained. EIO: no client has the slave open right now.
+        if (n < 0 && errno == EINTR)
+            continue;
+        break;
+    }
+    if (!data.isEmpty())
+        emit dataReady(data);
+}
@@ -0,0 +1,46 @@
+#ifndef PTYDEVICE_H
+#define PTYDEVICE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+
+class QSocketNotifier;
+
+// Master side of a Linux pseudo-terminal. The slave side (/dev/pts/N, or the
+// optional symlink) is what PumpController/QSerialPort opens instead of a real
+// COM port, so the simulators can stand in for the hardware.
+
+class PtyDevice : public QObject {
+    Q_OBJECT
+
+public:
+    explicit PtyDevice(QObject *parent = nullptr);
+    ~PtyDevice();
+
+    bool open(const QString &linkPath = QString());
+    void close();
+    bool write(const QByteArray &data);
+
+    QString slavePath() const;
+    QString linkPath() const;
+    QString errorString() const;
+
+signals:
+    void dataReady(const QByteArray &data);
+
+private slots:
+    void readPending();
+
+private:
+    static constexpr int writeTimeoutMs = 1000;     // how long write() waits for a full pty buffer to drain
+
+    int masterFd = -1;
+    int slaveFd = -1;       // held open so reads on the master don't EIO between clients
+    QSocketNotifier *notifier = nullptr;
+    QString slave;
+    QString link;
+    QString error;
+};
+
+#endif // PTYDEVICE_H
@@ -0,0 +1,22 @@
+# The serial pump stack from the main application, shared by the bench tools
+# so they exercise exactly the code PumpController runs.
+
+QT += serialport
+
+APPDIR = $$PWD/../..
+INCLUDEPATH += $$APPDIR
+
+SOURCES += \
+    $$APPDIR/pumpcommandworker.cpp \
+    $$APPDIR/pumpencoder.cpp \
+    $$APPDIR/pumpinterface.cpp \
+    $$APPDIR/pumpstatus.cpp \
+    $$APPDIR/serialframer.cpp
+
+HEADERS += \
+    $$APPDIR/pumpcommands.h \
+    $$APPDIR/pumpcommandworker.h \
+    $$APPDIR/pumpencoder.h \
+    $$APPDIR/pumpinterface.h \
+    $$APPDIR/pumpstatus.h \
+    $$APPDIR/serialframer.h
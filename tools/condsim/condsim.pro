@@ -0,0 +1,18 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = condsim
+
+INCLUDEPATH += $$PWD/../common
+
+SOURCES += \
+    main.cpp \
+    condsimulator.cpp \
+    $$PWD/../common/ptydevice.cpp
+
+HEADERS += \
+    condsimulator.h \
+    $$PWD/../common/ptydevice.h
@@ -0,0 +1,193 @@
+#include "condsimulator.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QTimer>
+#include <QTextStream>
+
+#include <algorithm>
+#include <cmath>
+
+CondSimulator::CondSimulator(const CondSimSettings &settings, QObject *parent)
+    : QObject(parent), settings(settings), pty(new PtyDevice(this)) {
+
+    rng = settings.seed ? QRandomGenerator(settings.seed)
+                        : QRandomGenerator(QRandomGenerator::global()->generate());
+
+    connect(pty, &PtyDevice::dataReady, this, &CondSimulator::receive);
+    clock.start();
+}
+
+bool CondSimulator::open(const QString &linkPath) {
+    return pty->open(linkPath);
+}
+
+QString CondSimulator::portName() const {
+    return pty->linkPath();
+}
+
+QString CondSimulator::errorString() const {
+    return pty->errorString();
+}
+
+void CondSimulator::printStats() const {
+    QTextStream out(stdout);
+    out << "Requests: " << requests << ", " << dropped << " dropped, "
+        << malformedSent << " malformed\n";
+    out.flush();
+}
+
+bool CondSimulator::parseWaveform(const QString &name, CondWaveform *waveform) {
+    const QString n = name.toLower();
+    if (n == "constant")
+        *waveform = CondWaveform::Constant;
+    else if (n == "sine")
+        *waveform = CondWaveform::Sine;
+    else if (n == "ramp")
+        *waveform = CondWaveform::Ramp;
+    else if (n == "square")
+        *waveform = CondWaveform::Square;
+    else
+        return false;
+    return true;
+}
+
+void CondSimulator::receive(const QByteArray &data) {
+    rxBuffer.append(data);
+
+    int end;
+    while ((end = rxBuffer.indexOf('\r')) != -1) {
+        QByteArray line = rxBuffer.left(end).trimmed();
+        rxBuffer.remove(0, end + 1);
+        if (!line.isEmpty())
+            dispatchLine(line);
+    }
+}
+
+void CondSimulator::dispatchLine(const QByteArray &line) {
+    ++requests;
+    const QByteArray command = line.toUpper();
+
+    // The meter echoes every command before answering it
+    QByteArray frame = command + "\r\n\r\n";
+    if (command == "GETMEAS") {
+        frame += measurement();
+    } else if (command.startsWith("SETRTC")) {
+        frame += "RTC updated";
+    } else {
+        frame += "Invalid command";
+    }
+    frame += "\r\n>";
+
+    if (roll(settings.malformedRate)) {
+        frame = malformed(frame);
+        ++malformedSent;
+    }
+
+    if (settings.verbose)
+        qInfo().noquote() << "<-" << command << "->" << frame.simplified();
+
+    if (roll(settings.dropRate)) {
+        ++dropped;
+        return;
+    }
+    scheduleReply(frame);
+}
+
+QByteArray CondSimulator::measurement() {
+    double value = std::max(0.0, valueAt(clock.elapsed() / 1000.0));
+
+    // Autoranges like the meter: uS/cm below 1000, mS/cm above
+    QByteArray reading;
+    QByteArray units;
+    if (value < 1000.0) {
+        reading = QByteArray::number(value, 'f', value < 100.0 ? 2 : 1);
+        units = "uS/cm";
+    } else {
+        reading = QByteArray::number(value / 1000.0, 'f', 3);
+        units = "mS/cm";
+    }
+
+    const QByteArray stamp = QDateTime::currentDateTime().toString("MM/dd/yy HH:mm:ss").toLatin1();
+    QByteArray report = "Lab Star EC112,X13034,1.08,ABCDE,";
+    report += stamp;
+    report += ",---,CH-1,Conductivity,Cond,";
+    report += reading;
+    report += ',';
+    report += units;
+    report += ",25.0,C,TC=2.10%/C,Cell=0.475";
+    return report;
+}
+
+QByteArray CondSimulator::malformed(const QByteArray &frame) {
+    switch (rng.bounded(3)) {
+    case 0: {
+        // Report cut short: still "Conductivity", but not enough fields
+        int cut = frame.indexOf(",Cond,");
+        return cut > 0 ? frame.left(cut) + "\r\n>" : frame;
+    }
+    case 1: {
+        // Non-numeric value where field 9 should be
+        QByteArray garbled = frame;
+        garbled.replace(",Cond,", ",Cond,#");
+        return garbled;
+    }
+    default:
+        // Lost the prompt, so the framer has to pick the next reply up cleanly
+        return frame.left(frame.size() - 1);
+    }
+}
+
+double CondSimulator::valueAt(double seconds) {
+    const double period = settings.periodSec > 0 ? settings.periodSec : 1.0;
+    const double phase = std::fmod(seconds, period) / period;     // 0..1
+    double value = settings.base;
+
+    switch (settings.waveform) {
+    case CondWaveform::Constant:
+        break;
+    case CondWaveform::Sine:
+        value += settings.amplitude * std::sin(2 * M_PI * phase);
+        break;
+    case CondWaveform::Ramp:
+        value += settings.amplitude * phase;
+        break;
+    case CondWaveform::Square:
+        value += phase < 0.5 ? settings.amplitude : -settings.amplitude;
+        break;
+    }
+
+    if (settings.noise > 0) {
+        // Box-Muller, good enough for a simulator
+        double u1 = std::max(rng.generateDouble(), 1e-12);
+        double u2 = rng.generateDouble();
+        value += settings.noise * std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2);
+    }
+    return value;
+}
+
+void CondSimulator::scheduleReply(const QByteArray &frame) {
+    const qint64 now = clock.elapsed();
+
+    // One measurement at a time, then the reply has to cross the line
+    qint64 ready = std::max(now, busyUntil) + processingDelay();
+    qint64 wireMs = 0;
+    if (settings.baudRate > 0)
+        wireMs = (frame.size() * 10 * 1000 + settings.baudRate - 1) / settings.baudRate;
+    busyUntil = ready + wireMs;
+
+    QTimer::singleShot(static_cast<int>(busyUntil - now), Qt::PreciseTimer, this, [this, frame]() {
+        pty->write(frame);
+    });
+}
+
+int CondSimulator::processingDelay() {
+    int delay = settings.delayMs;
+    if (settings.jitterMs > 0)
+        delay += rng.bounded(-settings.jitterMs, settings.jitterMs + 1);
+    return std::max(0, delay);
+}
+
+bool CondSimulator::roll(double probability) {
+    return probability > 0 && rng.generateDouble() < probability;
+}
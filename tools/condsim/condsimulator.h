@@ -0,0 +1,80 @@
+#ifndef CONDSIMULATOR_H
+#define CONDSIMULATOR_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+
+#include "ptydevice.h"
+
+// Stand-in for the Thermo Orion Lab Star EC112. Answers "GETMEAS\r" the way the
+// meter does: the command echoed back, then one comma-separated report line
+// and the '>' prompt, e.g.
+//  GETMEAS\r\n\r\nLab Star EC112,X13034,1.08,ABCDE,05/14/25 10:12:33,---,CH-1,
+//  Conductivity,Cond,12.34,mS/cm,25.0,C,TC=2.10%/C,Cell=0.475\r\n>
+// (one line on the wire). Value is field 9 and units field 10, same as the
+// real thing, and the meter autoranges between uS/cm and mS/cm.
+//
+// The reading follows a waveform over simulator time so a run has something to
+// plot, and replies can be delayed, dropped or malformed on purpose.
+
+enum class CondWaveform {
+    Constant,
+    Sine,
+    Ramp,           // sawtooth from base to base + amplitude
+    Square
+};
+
+struct CondSimSettings {
+    CondWaveform waveform = CondWaveform::Sine;
+    double base = 1000.0;       // uS/cm
+    double amplitude = 500.0;   // uS/cm
+    double periodSec = 60.0;
+    double noise = 0.0;         // gaussian sigma, uS/cm
+    int delayMs = 80;           // time the meter takes to answer
+    int jitterMs = 20;
+    int baudRate = 9600;        // 0 disables wire-time modelling
+    double dropRate = 0.0;      // request never answered
+    double malformedRate = 0.0; // short / truncated / garbled report
+    quint32 seed = 0;           // 0 = random
+    bool verbose = false;
+};
+
+class CondSimulator : public QObject {
+    Q_OBJECT
+
+public:
+    explicit CondSimulator(const CondSimSettings &settings, QObject *parent = nullptr);
+
+    bool open(const QString &linkPath = QString());
+    QString portName() const;
+    QString errorString() const;
+    void printStats() const;
+
+    static bool parseWaveform(const QString &name, CondWaveform *waveform);
+
+private slots:
+    void receive(const QByteArray &data);
+
+private:
+    void dispatchLine(const QByteArray &line);
+    QByteArray measurement();
+    QByteArray malformed(const QByteArray &frame);
+    double valueAt(double seconds);
+    void scheduleReply(const QByteArray &frame);
+    int processingDelay();
+    bool roll(double probability);
+
+    CondSimSettings settings;
+    PtyDevice *pty;
+    QElapsedTimer clock;
+    QRandomGenerator rng;
+    QByteArray rxBuffer;
+    qint64 busyUntil = 0;       // ms on the simulator clock
+    int requests = 0;
+    int dropped = 0;
+    int malformedSent = 0;
+};
+
+#endif // CONDSIMULATOR_H
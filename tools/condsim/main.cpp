@@ -0,0 +1,77 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+#include <csignal>
+
+#include "condsimulator.h"
+
+/* Orion Lab Star EC112 conductivity meter simulator
+ * Example usage:
+ *  condsim --link /tmp/ttyCondSim --waveform sine --base 1200 --amplitude 400 --period 30 --malformed 0.02
+ * then select /tmp/ttyCondSim as the meter port in Pump Controller.
+ */
+
+static void handleSignal(int)
+{
+    QCoreApplication::quit();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("condsim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Pseudo-terminal simulator for the Orion Lab Star EC112 conductivity meter");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"link", "Symlink to create for the pty slave.", "path"},
+        {"waveform", "constant, sine, ramp or square (default sine).", "shape", "sine"},
+        {"base", "Baseline conductivity in uS/cm (default 1000).", "uS", "1000"},
+        {"amplitude", "Waveform amplitude in uS/cm (default 500).", "uS", "500"},
+        {"period", "Waveform period in seconds (default 60).", "s", "60"},
+        {"noise", "Gaussian noise sigma in uS/cm (default 0).", "uS", "0"},
+        {"delay", "Time to answer a GETMEAS in ms (default 80).", "ms", "80"},
+        {"jitter", "Uniform jitter on the answer time in ms (default 20).", "ms", "20"},
+        {"baud", "Baud rate used to model wire time, 0 disables (default 9600).", "rate", "9600"},
+        {"drop", "Probability a request is never answered.", "p", "0"},
+        {"malformed", "Probability a reply is short, garbled or missing its '>'.", "p", "0"},
+        {"seed", "Random seed, 0 for a random one.", "n", "0"},
+        {{"v", "verbose"}, "Log every command and reply."},
+    });
+    parser.process(app);
+
+    CondSimSettings settings;
+    if (!CondSimulator::parseWaveform(parser.value("waveform"), &settings.waveform)) {
+        QTextStream(stderr) << "Unknown waveform: " << parser.value("waveform") << "\n";
+        return 1;
+    }
+    settings.base = parser.value("base").toDouble();
+    settings.amplitude = parser.value("amplitude").toDouble();
+    settings.periodSec = parser.value("period").toDouble();
+    settings.noise = parser.value("noise").toDouble();
+    settings.delayMs = parser.value("delay").toInt();
+    settings.jitterMs = parser.value("jitter").toInt();
+    settings.baudRate = parser.value("baud").toInt();
+    settings.dropRate = parser.value("drop").toDouble();
+    settings.malformedRate = parser.value("malformed").toDouble();
+    settings.seed = parser.value("seed").toUInt();
+    settings.verbose = parser.isSet("verbose");
+
+    CondSimulator sim(settings);
+    QTextStream out(stdout);
+    if (!sim.open(parser.value("link"))) {
+        QTextStream(stderr) << "Could not open pty: " << sim.errorString() << "\n";
+        return 1;
+    }
+    out << "Simulating EC112 on " << sim.portName() << "\n";
+    out.flush();
+
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    int result = app.exec();
+    sim.printStats();
+    return result;
+}
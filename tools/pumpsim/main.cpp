@@ -0,0 +1,71 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+#include <algorithm>
+#include <csignal>
+
+#include "pumpsimulator.h"
+
+/* NE-1002X pump simulator
+ * Example usage:
+ *  pumpsim --link /tmp/ttyPumpSim --delay 20 --jitter 5 --drop 0.01
+ * then select /tmp/ttyPumpSim as the pump port in Pump Controller (or uploadbench).
+ */
+
+static void handleSignal(int)
+{
+    QCoreApplication::quit();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("pumpsim");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Pseudo-terminal simulator for daisy-chained New Era NE-1002X pumps");
+    parser.addHelpOption();
+    parser.addOptions({
+        {"link", "Symlink to create for the pty slave.", "path"},
+        {"pumps", "Number of pumps on the bus (default 2).", "n", "2"},
+        {"delay", "Per-command processing time in ms (default 15).", "ms", "15"},
+        {"jitter", "Uniform jitter on the processing time in ms (default 5).", "ms", "5"},
+        {"baud", "Baud rate used to model wire time, 0 disables (default 19200).", "rate", "19200"},
+        {"drop", "Probability a reply is never sent.", "p", "0"},
+        {"corrupt", "Probability a reply loses its ETX byte.", "p", "0"},
+        {"error", "Probability a reply is ?COM.", "p", "0"},
+        {"seed", "Random seed, 0 for a random one.", "n", "0"},
+        {"speed", "Run phase programs this many times faster than real time (default 1).", "x", "1"},
+        {{"v", "verbose"}, "Log every command and reply."},
+    });
+    parser.process(app);
+
+    SimSettings settings;
+    settings.pumpCount = parser.value("pumps").toInt();
+    settings.delayMs = parser.value("delay").toInt();
+    settings.jitterMs = parser.value("jitter").toInt();
+    settings.baudRate = parser.value("baud").toInt();
+    settings.dropRate = parser.value("drop").toDouble();
+    settings.corruptRate = parser.value("corrupt").toDouble();
+    settings.errorRate = parser.value("error").toDouble();
+    settings.seed = parser.value("seed").toUInt();
+    settings.speed = std::max(0.001, parser.value("speed").toDouble());
+    settings.verbose = parser.isSet("verbose");
+
+    PumpSimulator sim(settings);
+    QTextStream out(stdout);
+    if (!sim.open(parser.value("link"))) {
+        QTextStream(stderr) << "Could not open pty: " << sim.errorString() << "\n";
+        return 1;
+    }
+    out << "Simulating " << settings.pumpCount << " pumps on " << sim.portName() << "\n";
+    out.flush();
+
+    std::signal(SIGINT, handleSignal);
+    std::signal(SIGTERM, handleSignal);
+
+    int result = app.exec();
+    sim.printStats();
+    return result;
+}
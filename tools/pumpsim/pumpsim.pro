@@ -0,0 +1,18 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = pumpsim
+
+INCLUDEPATH += $$PWD/../common
+
+SOURCES += \
+    main.cpp \
+    pumpsimulator.cpp \
+    $$PWD/../common/ptydevice.cpp
+
+HEADERS += \
+    pumpsimulator.h \
+    $$PWD/../common/ptydevice.h
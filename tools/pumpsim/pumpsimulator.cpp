@@ -0,0 +1,340 @@
+#include "pumpsimulator.h"
+
+#include <QDebug>
+#include <QTimer>
+#include <QTextStream>
+
+#include <algorithm>
+
+static const char STX = 0x02;
+static const char ETX = 0x03;
+
+PumpSimulator::PumpSimulator(const SimSettings &settings, QObject *parent)
+    : QObject(parent), settings(settings), pty(new PtyDevice(this)) {
+
+    rng = settings.seed ? QRandomGenerator(settings.seed)
+                        : QRandomGenerator(QRandomGenerator::global()->generate());
+
+    for (int i = 0; i < settings.pumpCount; ++i) {
+        SimPump pump;
+        pump.address = i;
+        pumps.append(pump);
+    }
+
+    connect(pty, &PtyDevice::dataReady, this, &PumpSimulator::receive);
+    clock.start();
+}
+
+bool PumpSimulator::open(const QString &linkPath) {
+    return pty->open(linkPath);
+}
+
+QString PumpSimulator::portName() const {
+    return pty->linkPath();
+}
+
+QString PumpSimulator::errorString() const {
+    return pty->errorString();
+}
+
+void PumpSimulator::printStats() const {
+    QTextStream out(stdout);
+    out << "Packets received: " << packets << "\n";
+    for (const SimPump &pump : pumps) {
+        out << "Pump " << pump.address << ": " << pump.commands << " commands, "
+            << pump.dropped << " replies dropped, " << pump.program.size() << " phases programmed";
+        if (pump.lastRunSeconds >= 0)
+            out << ", last run " << QString::number(pump.lastRunSeconds, 'f', 1) << " s";
+        out << "\n";
+    }
+    out.flush();
+}
+
+void PumpSimulator::receive(const QByteArray &data) {
+    rxBuffer.append(data);
+
+    int end;
+    while ((end = rxBuffer.indexOf('\r')) != -1) {
+        QByteArray line = rxBuffer.left(end);
+        rxBuffer.remove(0, end + 1);
+        if (!line.isEmpty())
+            dispatchLine(line);
+    }
+}
+
+void PumpSimulator::dispatchLine(const QByteArray &line) {
+    // "0RUN2*1RUN2*" is a network burst: one packet, one reply per pump
+    ++packets;
+    const QList<QByteArray> parts = line.split('*');
+    for (const QByteArray &part : parts) {
+        if (part.isEmpty())
+            continue;
+
+        int i = 0;
+        while (i < part.size() && part.at(i) >= '0' && part.at(i) <= '9')
+            ++i;
+        int address = (i > 0) ? part.left(i).toInt() : 0;
+        dispatchCommand(address, part.mid(i).trimmed().toUpper());
+    }
+}
+
+void PumpSimulator::dispatchCommand(int address, const QByteArray &command) {
+    if (address < 0 || address >= pumps.size()) {
+        // Nobody on the bus with that address, so nobody answers
+        if (settings.verbose)
+            qInfo().noquote() << "no pump at address" << address << "for" << command;
+        return;
+    }
+
+    SimPump &pump = pumps[address];
+    ++pump.commands;
+
+    QByteArray data;
+    if (roll(settings.errorRate)) {
+        data = "?COM";
+    } else {
+        data = execute(pump, command);
+    }
+
+    QByteArray frame;
+    frame.append(STX);
+    frame.append(QByteArray::number(address).rightJustified(2, '0'));
+    frame.append(pump.prompt);
+    frame.append(data);
+    if (!roll(settings.corruptRate))
+        frame.append(ETX);
+
+    if (settings.verbose)
+        qInfo().noquote() << "pump" << address << "<-" << command << "->" << frame.mid(1).replace(ETX, "");
+
+    if (roll(settings.dropRate)) {
+        ++pump.dropped;
+        return;
+    }
+    scheduleReply(pump, frame);
+}
+
+QByteArray PumpSimulator::execute(SimPump &pump, const QByteArray &command) {
+    const QByteArray op = command.left(3);
+    const QByteArray arg = command.mid(3);
+    SimPhase &phase = pump.program[pump.phase];
+
+    if (op == "VER") {
+        return "NE1002X V3.928";
+    }
+    if (op == "RUN") {
+        if (!arg.isEmpty()) {
+            int n = arg.toInt();
+            if (n < 1 || n > 41)
+                return "?OOR";
+            pump.phase = n;
+        }
+        startRun(pump);
+        return QByteArray();
+    }
+    if (op == "STP") {
+        // First STP pauses a running pump, a second one stops it
+        if (pump.prompt != 'S' && pump.prompt != 'P')
+            finishRun(pump, "stopped by STP");
+        pump.prompt = (pump.prompt == 'I' || pump.prompt == 'W' || pump.prompt == 'T') ? 'P' : 'S';
+        if (pump.prompt == 'S')
+            pump.phase = 1;
+        return QByteArray();
+    }
+    if (op == "PHN") {
+        if (arg.isEmpty())
+            return QByteArray::number(pump.phase).rightJustified(2, '0');
+        int n = arg.toInt();
+        if (n < 1 || n > 41)
+            return "?OOR";
+        pump.phase = n;
+        return QByteArray();
+    }
+    if (op == "FUN") {
+        if (arg.isEmpty())
+            return phase.function;
+        const QByteArray func = arg.left(3);
+        if (func != "RAT" && func != "LIN" && func != "STP" && func != "PAS"
+            && func != "LPS" && func != "LPE") {
+            return "?NA";
+        }
+        phase.function = func;
+        if (func == "PAS" || func == "LPE")
+            phase.time = arg.mid(3);
+        return QByteArray();
+    }
+    if (op == "RAT") {
+        if (arg.isEmpty())
+            return QByteArray::number(phase.rate, 'f', 1) + "UM";
+        bool ok = false;
+        double rate = QByteArray(arg).replace("UM", "").replace("MM", "").toDouble(&ok);
+        if (!ok || rate < 0)
+            return "?OOR";
+        phase.rate = rate;
+        return QByteArray();
+    }
+    if (op == "VOL") {
+        if (arg.isEmpty())
+            return QByteArray::number(phase.volume, 'f', 0) + "UL";
+        if (arg == "UL" || arg == "ML")
+            return QByteArray();
+        bool ok = false;
+        double vol = arg.toDouble(&ok);
+        if (!ok || vol < 0)
+            return "?OOR";
+        phase.volume = vol;
+        return QByteArray();
+    }
+    if (op == "DIR") {
+        if (arg.isEmpty())
+            return phase.direction;
+        if (arg != "INF" && arg != "WDR" && arg != "REV")
+            return "?NA";
+        phase.direction = (arg == "REV") ? (phase.direction == "INF" ? "WDR" : "INF") : arg;
+        return QByteArray();
+    }
+    if (op == "TIM" || op == "PAS") {
+        if (arg.isEmpty())
+            return phase.time;
+        phase.time = arg;
+        return QByteArray();
+    }
+    return "?";
+}
+
+void PumpSimulator::scheduleReply(SimPump &pump, const QByteArray &frame) {
+    const qint64 now = clock.elapsed();
+
+    // The pump can't start on this command until it's done with the last one
+    qint64 ready = std::max(now, pump.busyUntil) + processingDelay();
+    pump.busyUntil = ready;
+
+    // Replies from every pump share one line back to the host
+    qint64 wireMs = 0;
+    if (settings.baudRate > 0)
+        wireMs = (frame.size() * 10 * 1000 + settings.baudRate - 1) / settings.baudRate;
+    qint64 start = std::max(ready, wireFreeAt);
+    wireFreeAt = start + wireMs;
+
+    QTimer::singleShot(static_cast<int>(wireFreeAt - now), Qt::PreciseTimer, this, [this, frame]() {
+        pty->write(frame);
+    });
+}
+
+void PumpSimulator::startRun(SimPump &pump) {
+    ++pump.run;
+    pump.loops.clear();
+    pump.runStart = clock.elapsed();
+    pump.steps = 0;
+    enterPhase(pump.address, pump.run);
+}
+
+void PumpSimulator::enterPhase(int address, int run) {
+    SimPump &pump = pumps[address];
+    if (pump.run != run)
+        return;     // stopped or restarted since this was scheduled
+
+    // Loop bookkeeping takes no time, so walk through it here. The step limit
+    // only guards against a program that loops with nothing in the body.
+    while (true) {
+        if (++pump.steps > 100000) {
+            finishRun(pump, "stuck in an empty loop");
+            pump.prompt = 'S';
+            return;
+        }
+        auto it = pump.program.constFind(pump.phase);
+        if (it == pump.program.constEnd() || it->function == "STP") {
+            finishRun(pump, it == pump.program.constEnd() ? "ran off the program" : "reached STP");
+            pump.prompt = 'S';
+            return;
+        }
+        if (it->function == "LPS") {
+            pump.loops.append({pump.phase + 1, 0});
+            ++pump.phase;
+            continue;
+        }
+        if (it->function == "LPE") {
+            if (pump.loops.isEmpty()) {
+                ++pump.phase;       // unmatched, the pump ignores it
+                continue;
+            }
+            SimLoop &loop = pump.loops.last();
+            if (++loop.passes < it->time.toInt()) {
+                pump.phase = loop.firstPhase;
+            } else {
+                pump.loops.removeLast();
+                ++pump.phase;
+            }
+            continue;
+        }
+        break;
+    }
+
+    const SimPhase &phase = pump.program[pump.phase];
+    if (phase.function == "PAS")
+        pump.prompt = 'T';
+    else
+        pump.prompt = (phase.direction == "WDR") ? 'W' : 'I';
+
+    int skip = 1;
+    double seconds = phaseSeconds(pump, &skip);
+    if (settings.verbose)
+        qInfo().noquote() << "pump" << pump.address << "phase" << pump.phase << phase.function
+                          << "for" << seconds << "s at" << simSeconds(pump) << "s";
+    if (seconds < 0)
+        return;     // runs until stopped
+
+    const int next = pump.phase + skip;
+    QTimer::singleShot(static_cast<int>(seconds * 1000 / settings.speed), Qt::PreciseTimer, this,
+                       [this, address, run, next]() {
+        SimPump &pump = pumps[address];
+        if (pump.run != run)
+            return;
+        pump.phase = next;
+        enterPhase(address, run);
+    });
+}
+
+double PumpSimulator::phaseSeconds(const SimPump &pump, int *skip) const {
+    const SimPhase &phase = pump.program[pump.phase];
+    if (phase.function == "PAS")
+        return phase.time.toDouble();
+    if (phase.function == "LIN") {
+        // HH:MM here, SS:tenths on the phase after; the pair is one ramp
+        const SimPhase end = pump.program.value(pump.phase + 1);
+        const QList<QByteArray> hm = phase.time.split(':');
+        const QList<QByteArray> st = end.time.split(':');
+        *skip = 2;
+        return hm.value(0).toInt() * 3600.0 + hm.value(1).toInt() * 60.0
+               + st.value(0).toInt() + st.value(1).toInt() / 10.0;
+    }
+    // RAT: until the volume is delivered
+    if (phase.volume <= 0 || phase.rate <= 0)
+        return -1;
+    return phase.volume / phase.rate * 60.0;
+}
+
+double PumpSimulator::simSeconds(const SimPump &pump) const {
+    return (clock.elapsed() - pump.runStart) * settings.speed / 1000.0;
+}
+
+void PumpSimulator::finishRun(SimPump &pump, const char *why) {
+    ++pump.run;
+    pump.loops.clear();
+    pump.lastRunSeconds = simSeconds(pump);
+    QTextStream out(stdout);
+    out << "pump " << pump.address << " " << why << " after "
+        << QString::number(pump.lastRunSeconds, 'f', 1) << " s\n";
+    out.flush();
+}
+
+int PumpSimulator::processingDelay() {
+    int delay = settings.delayMs;
+    if (settings.jitterMs > 0)
+        delay += rng.bounded(-settings.jitterMs, settings.jitterMs + 1);
+    return std::max(0, delay);
+}
+
+bool PumpSimulator::roll(double probability) {
+    return probability > 0 && rng.generateDouble() < probability;
+}
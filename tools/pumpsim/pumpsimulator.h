@@ -0,0 +1,107 @@
+#ifndef PUMPSIMULATOR_H
+#define PUMPSIMULATOR_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QRandomGenerator>
+#include <QVector>
+
+#include "ptydevice.h"
+
+// Stand-in for the daisy-chained New Era NE-1002X pumps. Parses the packets
+// PumpInterface writes (single "<addr><cmd>\r" and "<addr><cmd>*<addr><cmd>*\r"
+// bursts) and answers each addressed pump with STX + "<addr><prompt><data>" + ETX.
+//
+// Each pump works through its commands one at a time (processing delay +
+// jitter), and replies share the one RS-232 line back to the host, so
+// serialisation on the wire is modelled at the configured baud rate.
+//
+// RUN executes the phase program, sped up by SimSettings::speed: RAT runs
+// until its volume is delivered (forever with none), a LIN pair ramps for the
+// time split across its two phases, PAS waits (prompt 'T'), LPS/LPE loop, and
+// a STP phase or an unprogrammed one ends the run. LPE nn jumps back to its
+// LPS until the body has run nn times in all, as the firmware does. Each
+// finished run is logged with its simulated length, so a compiled program can
+// be checked against the protocol it came from.
+
+struct SimSettings {
+    int pumpCount = 2;
+    int delayMs = 15;           // per-command processing time inside a pump
+    int jitterMs = 5;           // uniform +/- on top of delayMs
+    int baudRate = 19200;       // 0 disables wire-time modelling
+    double dropRate = 0.0;      // reply never sent
+    double corruptRate = 0.0;   // reply sent without its ETX
+    double errorRate = 0.0;     // reply is "?COM" instead of the real answer
+    quint32 seed = 0;           // 0 = random
+    double speed = 1.0;         // simulated seconds per real second while running a program
+    bool verbose = false;
+};
+
+struct SimPhase {
+    QByteArray function = "RAT";
+    double rate = 0.0;
+    double volume = 0.0;
+    QByteArray time;
+    QByteArray direction = "INF";
+};
+
+struct SimLoop {
+    int firstPhase = 0;         // phase after the LPS
+    int passes = 0;             // times the body has run so far
+};
+
+struct SimPump {
+    int address = 0;
+    char prompt = 'S';          // S stopped, I infusing, W withdrawing, P paused, T pause phase
+    int phase = 1;
+    QMap<int, SimPhase> program;
+    QVector<SimLoop> loops;     // open LPS/LPE loops, innermost last
+    int run = 0;                // bumped on every RUN/STP, so stale phase timers do nothing
+    qint64 runStart = 0;        // ms on the simulator clock
+    int steps = 0;              // phases entered this run
+    double lastRunSeconds = -1; // simulated length of the last finished run
+    qint64 busyUntil = 0;       // ms on the simulator clock
+    int commands = 0;
+    int dropped = 0;
+};
+
+class PumpSimulator : public QObject {
+    Q_OBJECT
+
+public:
+    explicit PumpSimulator(const SimSettings &settings, QObject *parent = nullptr);
+
+    bool open(const QString &linkPath = QString());
+    QString portName() const;
+    QString errorString() const;
+    void printStats() const;
+
+private slots:
+    void receive(const QByteArray &data);
+
+private:
+    void dispatchLine(const QByteArray &line);
+    void dispatchCommand(int address, const QByteArray &command);
+    QByteArray execute(SimPump &pump, const QByteArray &command);
+    void scheduleReply(SimPump &pump, const QByteArray &frame);
+    void startRun(SimPump &pump);
+    void enterPhase(int address, int run);
+    void finishRun(SimPump &pump, const char *why);
+    double phaseSeconds(const SimPump &pump, int *skip) const;
+    double simSeconds(const SimPump &pump) const;
+    int processingDelay();
+    bool roll(double probability);
+
+    SimSettings settings;
+    PtyDevice *pty;
+    QElapsedTimer clock;
+    QRandomGenerator rng;
+    QVector<SimPump> pumps;
+    QByteArray rxBuffer;
+    qint64 wireFreeAt = 0;
+    int packets = 0;
+};
+
+#endif // PUMPSIMULATOR_H
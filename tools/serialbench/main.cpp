@@ -0,0 +1,261 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+
+#include "condparser.h"
+#include "serialframer.h"
+
+/* Serial parsing microbenchmark: the QByteArray append/indexOf/remove loop the
+ * interfaces used to run versus SerialFramer. Both sides still build the
+ * QString PumpInterface emits, so the numbers are what handleReadyRead pays.
+ * Then the GETMEAS report parse on its own: QString contains/split plus the
+ * units string compare, versus parseCondFrame.
+ * Example usage:
+ *  serialbench
+ */
+
+// Count every heap allocation in the process. QByteArray and QString go
+// straight to malloc/realloc, so operator new alone misses most of them:
+// with glibc the C allocator is interposed here instead, which catches
+// operator new as well (it calls malloc).
+static std::atomic<long long> allocations{0};
+
+#if defined(__GLIBC__)
+static constexpr bool countsAllocations = true;
+
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *p, std::size_t size);
+
+void *malloc(std::size_t size)
+{
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size)
+{
+    ++allocations;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, std::size_t size)
+{
+    // Growing a buffer in place still costs an allocator call
+    ++allocations;
+    return __libc_realloc(p, size);
+}
+}
+#else
+// No portable way to hook malloc here, so the alloc columns are left blank
+static constexpr bool countsAllocations = false;
+#endif
+
+static QString allocColumn(double perFrame, int width)
+{
+    return countsAllocations ? QString("%1").arg(perFrame, width, 'f', 2) : QString("%1").arg("-", width);
+}
+
+struct Result {
+    double mbPerSec = 0;
+    double allocsPerFrame = 0;
+    long long frames = 0;
+};
+
+static QByteArray pumpStream(int frames)
+{
+    QByteArray data;
+    for (int i = 0; i < frames; ++i) {
+        data.append(char(0x02));
+        data.append((i % 2) ? "01S" : "00I");
+        if (i % 5 == 0)
+            data.append("NE1002X V3.928");
+        data.append(char(0x03));
+    }
+    return data;
+}
+
+static QByteArray condStream(int frames)
+{
+    QByteArray data;
+    for (int i = 0; i < frames; ++i) {
+        data.append("GETMEAS\r\n\r\nLab Star EC112,X13034,1.08,ABCDE,05/14/25 10:12:33,---,CH-1,"
+                    "Conductivity,Cond,12.34,mS/cm,25.0,C,TC=2.10%/C,Cell=0.475\r\n>");
+    }
+    return data;
+}
+
+// The pre-SerialFramer PumpInterface::handleReadyRead
+static long long legacyPump(QByteArray &buffer, const char *chunk, int n)
+{
+    long long frames = 0;
+    buffer.append(chunk, n);
+    while (true) {
+        int startIndex = buffer.indexOf(static_cast<char>(0x02));
+        int endIndex = buffer.indexOf(static_cast<char>(0x03), startIndex + 1);
+        if (startIndex != -1 && endIndex != -1 && endIndex > startIndex) {
+            QByteArray payload = buffer.mid(startIndex + 1, endIndex - startIndex - 1);
+            QString readable = QString::fromLatin1(payload);
+            frames += readable.isEmpty() ? 0 : 1;
+            buffer.remove(0, endIndex + 1);
+        } else {
+            break;
+        }
+    }
+    return frames;
+}
+
+// The pre-SerialFramer CondInterface::handleReadyRead framing
+static long long legacyCond(QByteArray &buffer, const char *chunk, int n)
+{
+    long long frames = 0;
+    buffer.append(chunk, n);
+    while (true) {
+        int endIndex = buffer.indexOf('>');
+        if (endIndex == -1)
+            break;
+        QByteArray frame = buffer.left(endIndex + 1);
+        buffer.remove(0, endIndex + 1);
+        QString response = QString::fromLatin1(frame).trimmed();
+        frames += response.isEmpty() ? 0 : 1;
+    }
+    return frames;
+}
+
+static long long framed(SerialFramer &framer, const char *chunk, int n)
+{
+    long long frames = 0;
+    int offset = 0;
+    while (offset < n) {
+        offset += framer.append(chunk + offset, n - offset);
+        FrameView frame;
+        while (framer.next(frame)) {
+            QString readable = QString::fromLatin1(frame.data, frame.size);
+            frames += readable.isEmpty() ? 0 : 1;
+        }
+    }
+    return frames;
+}
+
+// The pre-parseCondFrame CondInterface::handleFrame, plus the units check
+// receiveCondMeasurement did on every reading
+static double legacyParse(const char *data, int size)
+{
+    QString response = QString::fromLatin1(data, size).trimmed();
+    if (response.contains("RTC updated"))
+        return -1;
+    if (!response.contains("Conductivity"))
+        return -1;
+    QStringList fields = response.split(',');
+    if (fields.size() < 12)
+        return -1;
+    double value = fields[9].toDouble();
+    QString units = fields[10].trimmed();
+    if (units == "mS/cm")
+        return value;
+    if (units == "uS/cm")
+        return value / 1000;
+    return value;
+}
+
+static double tokenizedParse(const char *data, int size)
+{
+    CondFrame parsed = parseCondFrame(data, size);
+    if (parsed.kind != CondFrameKind::Measurement)
+        return -1;
+    return condToMilliSiemens(parsed.value, parsed.units);
+}
+
+template <typename Parse>
+static void runParse(QTextStream &out, const char *name, const QByteArray &frame, int repeats, Parse parse)
+{
+    double sum = 0;
+    // Warm-up call first: static QString/QByteArray data isn't part of a parse
+    sum += parse(frame.constData(), int(frame.size()));
+    long long allocsBefore = allocations;
+    QElapsedTimer timer;
+    timer.start();
+    for (int r = 0; r < repeats; ++r)
+        sum += parse(frame.constData(), int(frame.size()));
+    double ns = double(timer.nsecsElapsed()) / repeats;
+    double allocs = double(allocations - allocsBefore) / repeats;
+    out << QString("%1 %2 %3   (checksum %4)\n")
+               .arg(name, -10)
+               .arg(ns, 10, 'f', 1)
+               .arg(allocColumn(allocs, 12))
+               .arg(sum, 0, 'f', 1);
+}
+
+template <typename Feed>
+static Result run(const QByteArray &stream, int chunkSize, int repeats, Feed feed)
+{
+    Result result;
+    long long allocsBefore = allocations;
+    QElapsedTimer timer;
+    timer.start();
+    for (int r = 0; r < repeats; ++r) {
+        for (int i = 0; i < stream.size(); i += chunkSize) {
+            int n = std::min(chunkSize, int(stream.size()) - i);
+            result.frames += feed(stream.constData() + i, n);
+        }
+    }
+    double secs = timer.nsecsElapsed() / 1e9;
+    result.mbPerSec = double(stream.size()) * repeats / secs / 1e6;
+    result.allocsPerFrame = result.frames ? double(allocations - allocsBefore) / result.frames : 0;
+    return result;
+}
+
+static void report(QTextStream &out, const char *name, int chunk, const Result &legacy, const Result &framer)
+{
+    out << QString("%1 %2 %3 %4 %5 %6 %7\n")
+               .arg(name, -6)
+               .arg(chunk, 6)
+               .arg(legacy.mbPerSec, 10, 'f', 1)
+               .arg(framer.mbPerSec, 10, 'f', 1)
+               .arg(allocColumn(legacy.allocsPerFrame, 12))
+               .arg(allocColumn(framer.allocsPerFrame, 12))
+               .arg(legacy.frames == framer.frames ? "" : "  FRAME COUNT MISMATCH");
+}
+
+int main()
+{
+    QTextStream out(stdout);
+    const QByteArray pumps = pumpStream(20000);
+    const QByteArray cond = condStream(2000);
+
+    if (!countsAllocations)
+        out << "(allocation counting needs glibc, alloc columns are not measured)\n";
+    out << "stream  chunk  legacy MB/s  framer MB/s  legacy alloc/frame  framer alloc/frame\n";
+    for (int chunk : {1, 8, 64, 512, 4096, 65536}) {
+        const int repeats = chunk < 8 ? 2 : 10;
+
+        QByteArray buffer;
+        Result legacy = run(pumps, chunk, repeats, [&buffer](const char *p, int n) { return legacyPump(buffer, p, n); });
+        SerialFramer pumpFramer(0x02, 0x03);
+        Result framer = run(pumps, chunk, repeats, [&pumpFramer](const char *p, int n) { return framed(pumpFramer, p, n); });
+        report(out, "pump", chunk, legacy, framer);
+
+        buffer.clear();
+        Result legacyC = run(cond, chunk, repeats, [&buffer](const char *p, int n) { return legacyCond(buffer, p, n); });
+        SerialFramer condFramer(0, '>');
+        Result framerC = run(cond, chunk, repeats, [&condFramer](const char *p, int n) { return framed(condFramer, p, n); });
+        report(out, "cond", chunk, legacyC, framerC);
+        out.flush();
+    }
+
+    // One report as the framer hands it over: no '>', the echo still in front
+    const QByteArray report = cond.left(cond.indexOf('>'));
+    const int parseRepeats = 200000;
+    out << "\nGETMEAS parse  ns/frame  alloc/frame\n";
+    runParse(out, "legacy", report, parseRepeats, legacyParse);
+    runParse(out, "tokenizer", report, parseRepeats, tokenizedParse);
+    out.flush();
+    return 0;
+}
@@ -0,0 +1,19 @@
+QT       += core
+QT       -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = serialbench
+
+APPDIR = $$PWD/../..
+INCLUDEPATH += $$APPDIR
+
+SOURCES += \
+    main.cpp \
+    $$APPDIR/condparser.cpp \
+    $$APPDIR/serialframer.cpp
+
+HEADERS += \
+    $$APPDIR/condparser.h \
+    $$APPDIR/serialframer.h
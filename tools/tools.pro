@@ -0,0 +1,7 @@
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    pumpsim \
+    condsim \
+    uploadbench \
+    serialbench
@@ -0,0 +1,166 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTextStream>
+#include <QTimer>
+
+#include <algorithm>
+
+#include "pumpinterface.h"
+
+/* Times a full two-pump phase-program upload through PumpInterface/PumpCommandWorker.
+ * Example usage:
+ *  pumpsim --link /tmp/ttyPumpSim &
+ *  uploadbench /tmp/ttyPumpSim --phases 40 --runs 5
+ */
+
+static QVector<PumpPhase> benchProgram(int phaseCount, double baseRate)
+{
+    // Mix of what generatePumpPhases produces: holds, ramps and pauses, then a STOP
+    QVector<PumpPhase> phases;
+    int n = 1;
+    while (n < phaseCount) {
+        PumpPhase phase;
+        phase.phaseNumber = n;
+        switch (n % 4) {
+        case 1:
+            phase.function = "RAT";
+            phase.rate = baseRate + n;
+            phase.volume = (baseRate + n) * 2;
+            break;
+        case 2:
+        case 3:
+            phase.function = "LIN";
+            phase.rate = baseRate + 10 * n;
+            phase.time = (n % 4 == 2) ? "00:05" : "30:00";
+            break;
+        default:
+            phase.function = "PAUSE";
+            phase.time = "99";
+            break;
+        }
+        phases.append(phase);
+        ++n;
+    }
+    PumpPhase stop;
+    stop.phaseNumber = n;
+    stop.function = "STOP";
+    phases.append(stop);
+    return phases;
+}
+
+static bool waitFor(PumpInterface &pumps, int timeoutMs)
+{
+    QEventLoop loop;
+    QTimer timeout;
+    timeout.setSingleShot(true);
+    QObject::connect(&pumps, &PumpInterface::queueEmpty, &loop, &QEventLoop::quit);
+    QObject::connect(&timeout, &QTimer::timeout, &loop, [&loop]() { loop.exit(1); });
+    timeout.start(timeoutMs);
+    return loop.exec() == 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("uploadbench");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures setPhases upload time against real pumps or pumpsim");
+    parser.addHelpOption();
+    parser.addPositionalArgument("port", "Serial port (or pumpsim pty) of the pump bus.");
+    parser.addOptions({
+        {"phases", "Phases per pump, including the final STOP (default 40).", "n", "40"},
+        {"runs", "Number of uploads to time (default 3).", "n", "3"},
+        {"timeout", "Give up on an upload after this many seconds (default 120).", "s", "120"},
+    });
+    parser.process(app);
+
+    if (parser.positionalArguments().isEmpty())
+        parser.showHelp(1);
+
+    const QString port = parser.positionalArguments().first();
+    const int phaseCount = std::max(2, parser.value("phases").toInt());
+    const int runs = std::max(1, parser.value("runs").toInt());
+    const int timeoutMs = parser.value("timeout").toInt() * 1000;
+
+    QTextStream out(stdout);
+    PumpInterface pumps;
+    int responses = 0;
+    QObject::connect(&pumps, &PumpInterface::dataReceived, [&responses](const QString &) { ++responses; });
+    QObject::connect(&pumps, &PumpInterface::errorOccurred, [&out](const QString &err) {
+        out << "error: " << err << "\n";
+        out.flush();
+    });
+
+    if (!pumps.connectToPumps(port))
+        return 1;
+    if (!waitFor(pumps, timeoutMs)) {
+        out << "No answer to the connect-time commands on " << port << "\n";
+        return 1;
+    }
+
+    const QVector<QVector<PumpPhase>> program = {
+        benchProgram(phaseCount, 100.0),
+        benchProgram(phaseCount, 300.0)
+    };
+
+    // Commands and wall time for one upload, or -1 if it stalled
+    auto timeUpload = [&](const QString &label, const QVector<QVector<PumpPhase>> &phases) -> double {
+        responses = 0;
+        QElapsedTimer timer;
+        timer.start();
+        if (pumps.setPhases(phases) == 0) {
+            return 0;   // nothing to send, and no queueEmpty to wait for
+        }
+        if (!waitFor(pumps, timeoutMs)) {
+            out << label << " stalled after " << responses << " responses\n";
+            return -1;
+        }
+        double ms = timer.nsecsElapsed() / 1e6;
+        out << label << ": " << responses << " responses in "
+            << QString::number(ms, 'f', 1) << " ms ("
+            << QString::number(responses * 1000.0 / ms, 'f', 1) << " cmd/s)\n";
+        out.flush();
+        return ms;
+    };
+
+    auto summary = [&out](const QString &label, QVector<double> times) {
+        std::sort(times.begin(), times.end());
+        out << label << ": min " << QString::number(times.first(), 'f', 1)
+            << " ms, median " << QString::number(times.at(times.size() / 2), 'f', 1)
+            << " ms, max " << QString::number(times.last(), 'f', 1) << " ms\n";
+    };
+
+    // Full uploads: forget what the pumps hold so every run sends everything
+    QVector<double> times;
+    for (int run = 0; run < runs; ++run) {
+        pumps.invalidatePhaseMirror();
+        double ms = timeUpload(QString("Run %1").arg(run + 1), program);
+        if (ms < 0) {
+            return 2;
+        }
+        times.append(ms);
+    }
+    summary(QString("Upload of 2 x %1 phases").arg(phaseCount), times);
+
+    // Incremental re-uploads: one rate changed per pump, the mirror skips the rest
+    QVector<double> incremental;
+    QVector<QVector<PumpPhase>> edited = program;
+    for (int run = 0; run < runs; ++run) {
+        for (auto &phases : edited) {
+            phases[0].rate += 1;
+            phases[0].volume = phases[0].rate * 2;
+        }
+        double ms = timeUpload(QString("Re-upload %1").arg(run + 1), edited);
+        if (ms < 0) {
+            return 2;
+        }
+        incremental.append(ms);
+    }
+    summary("Incremental re-upload (1 phase per pump)", incremental);
+
+    pumps.shutdown();
+    return 0;
+}
@@ -1,9 +1,15 @@
 #include "utils.h"
+#include <QDeadlineTimer>
 #include <limits>
 #include <algorithm>
 
 namespace utils {
 
+qint64 monotonicNs()
+{
+    return QDeadlineTimer::current(Qt::PreciseTimer).deadlineNSecs();
+}
+
 std::pair<double, double> findReasonableMinMax(
     const QVector<double>& data,
     double minAcceptable,
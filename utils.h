@@ -2,10 +2,15 @@
 #define UTILS_H
 
 #include <QVector>
+#include <QtGlobal>
 #include <utility>  // for std::pair
 
 namespace utils {
 
+// Monotonic clock in ns, same reference on every thread. Use this (not
+// QTime/QDateTime) for anything that gets subtracted.
+qint64 monotonicNs();
+
 std::pair<double, double> findReasonableMinMax(
     const QVector<double>& data,
     double minAcceptable,